@@ -0,0 +1,466 @@
+#include "audiomix.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavfilter/buffersrc.h>
+
+/*
+ * multi-track audio mixing
+ *
+ * every audio track besides the main one (commentary, several microphones) has its own
+ * packet queue, decoder thread and frame queue.
+ * In the audio filter graph each goes through its own volume into amix together
+ * with the main track and comes out as one stream.
+ * Switching tracks only changes the gains, the decoders and the audio device stay open, so nothing stalls.
+ * The main audio thread takes the frames of the tracks after it fed the main frame,
+ * frames from before a seek are dropped by serial.
+ */
+void audio_mix_init(AudioMix *m)
+{
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < AUDIO_MIX_MAX_TRACKS; i++)
+        SDL_AtomicSet(&m->gains[i], 100);
+}
+
+/* "all" or stream indices separated by commas */
+int audio_mix_parse_streams(AudioMix *m, const char *list)
+{
+    const char *p = list;
+
+    m->nb_streams = 0;
+    m->all = !strcmp(list, "all");
+    if (m->all)
+        return 0;
+
+    while (*p)
+    {
+        char *end;
+        long index = strtol(p, &end, 10);
+
+        if (end == p || index < 0 || (*end && *end != ','))
+        {
+            av_log(NULL, AV_LOG_ERROR, "Invalid audio track list %s\n", list);
+            m->nb_streams = 0;
+            return AVERROR(EINVAL);
+        }
+        if (m->nb_streams < FF_ARRAY_ELEMS(m->streams))
+            m->streams[m->nb_streams++] = (int)index;
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
+/* percents separated by commas, the main stream first */
+void audio_mix_parse_gains(AudioMix *m, const char *list)
+{
+    const char *p = list;
+    int i;
+
+    for (i = 0; i < AUDIO_MIX_MAX_TRACKS && *p; i++)
+    {
+        audio_mix_set_gain(m, i, atoi(p));
+        if (!(p = strchr(p, ',')))
+            break;
+        p++;
+    }
+}
+
+static int audio_track_thread(void *arg)
+{
+    AudioTrack *t = arg;
+    AVFrame *frame = av_frame_alloc();
+    Frame *af;
+    int got_frame;
+
+    if (!frame)
+        return AVERROR(ENOMEM);
+
+    while ((got_frame = decoder_decode_frame(&t->dec, frame)) >= 0)
+    {
+        if (!got_frame)
+            continue;
+        if (!(af = frame_queue_peek_writable(&t->fq)))
+            break;
+
+        af->pts = frame->pts == AV_NOPTS_VALUE ? NAN : (double)frame->pts / frame->sample_rate;
+        af->pos = -1;
+        af->serial = t->dec.pkt_serial;
+        af->duration = (double)frame->nb_samples / frame->sample_rate;
+        av_frame_move_ref(af->frame, frame);
+        frame_queue_push(&t->fq);
+    }
+    av_frame_free(&frame);
+    return 0;
+}
+
+static void audio_track_free(AudioTrack *t, int started)
+{
+    if (started)
+        decoder_abort(&t->dec, &t->fq);
+    decoder_destroy(&t->dec);
+    frame_queue_destroy(&t->fq);
+    packet_queue_destroy(&t->q);
+    av_channel_layout_uninit(&t->ch_layout);
+}
+
+static int audio_track_open(AudioTrack *t, AVFormatContext *ic, int stream_index, const char *codec_name,
+    int threads, SDL_cond *empty_queue_cond)
+{
+    AVCodecContext *avctx;
+    const AVCodec *codec;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    memset(t, 0, sizeof(*t));
+    t->stream_index = stream_index;
+
+    if (!(avctx = avcodec_alloc_context3(NULL)))
+        return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(avctx, ic->streams[stream_index]->codecpar)) < 0)
+        goto fail;
+    avctx->pkt_timebase = ic->streams[stream_index]->time_base;
+
+    codec = codec_name ? avcodec_find_decoder_by_name(codec_name) : avcodec_find_decoder(avctx->codec_id);
+    if (!codec)
+    {
+        av_log(NULL, AV_LOG_WARNING, "No decoder could be found for audio track #%d\n", stream_index);
+        ret = AVERROR(EINVAL);
+        goto fail;
+    }
+    avctx->codec_id = codec->id;
+
+    av_dict_set_int(&opts, "threads", threads, 0);
+    ret = avcodec_open2(avctx, codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        goto fail;
+
+    t->freq = avctx->sample_rate;
+    t->fmt = avctx->sample_fmt;
+    if ((ret = av_channel_layout_copy(&t->ch_layout, &avctx->ch_layout)) < 0)
+        goto fail;
+
+    if ((ret = packet_queue_init(&t->q)) < 0)
+        goto fail;
+    if ((ret = frame_queue_init(&t->fq, &t->q, SAMPLE_QUEUE_SIZE, 0)) < 0)
+    {
+        packet_queue_destroy(&t->q);
+        goto fail;
+    }
+    if ((ret = decoder_init(&t->dec, avctx, &t->q, empty_queue_cond)) < 0)
+    {
+        frame_queue_destroy(&t->fq);
+        packet_queue_destroy(&t->q);
+        goto fail;
+    }
+
+    packet_queue_start(&t->q);
+    if (!(t->dec.decoder_tid = SDL_CreateThread(audio_track_thread, "audio_track", t)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        audio_track_free(t, 0);
+        return AVERROR(ENOMEM);
+    }
+    ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+    return 0;
+
+fail:
+    av_channel_layout_uninit(&t->ch_layout);
+    avcodec_free_context(&avctx);
+    return ret;
+}
+
+static int audio_mix_wanted(AudioMix *m, AVFormatContext *ic, int stream_index)
+{
+    AVCodecParameters *par = ic->streams[stream_index]->codecpar;
+    int i;
+
+    if (par->codec_type != AVMEDIA_TYPE_AUDIO || !par->sample_rate || !par->ch_layout.nb_channels)
+        return 0;
+    if (m->all)
+        return 1;
+    for (i = 0; i < m->nb_streams; i++)
+        if (m->streams[i] == stream_index)
+            return 1;
+    return 0;
+}
+
+int audio_mix_open(AudioMix *m, AVFormatContext *ic, int main_stream, const char *codec_name,
+    int threads, SDL_cond *empty_queue_cond)
+{
+    int i;
+
+    for (i = 0; i < ic->nb_streams && m->nb_tracks < FF_ARRAY_ELEMS(m->tracks); i++)
+    {
+        if (i == main_stream || !audio_mix_wanted(m, ic, i))
+            continue;
+        if (audio_track_open(&m->tracks[m->nb_tracks], ic, i, codec_name, threads, empty_queue_cond) < 0)
+            continue;
+        av_log(NULL, AV_LOG_INFO, "Audio track %d mixes stream #%d\n", m->nb_tracks + 1, i);
+        m->nb_tracks++;
+    }
+    return m->nb_tracks;
+}
+
+void audio_mix_close(AudioMix *m, AVFormatContext *ic)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+    {
+        AudioTrack *t = &m->tracks[i];
+
+        audio_track_free(t, 1);
+        if (ic && t->stream_index < ic->nb_streams)
+            ic->streams[t->stream_index]->discard = AVDISCARD_ALL;
+    }
+    m->nb_tracks = 0;
+}
+
+AudioTrack *audio_mix_track(AudioMix *m, int stream_index)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+        if (m->tracks[i].stream_index == stream_index)
+            return &m->tracks[i];
+    return NULL;
+}
+
+void audio_mix_flush(AudioMix *m)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+        packet_queue_flush(&m->tracks[i].q);
+}
+
+void audio_mix_put_nullpackets(AudioMix *m, AVPacket *pkt)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+        packet_queue_put_nullpacket(&m->tracks[i].q, pkt, m->tracks[i].stream_index);
+}
+
+int audio_mix_queue_size(AudioMix *m)
+{
+    int i, size = 0;
+
+    for (i = 0; i < m->nb_tracks; i++)
+        size += m->tracks[i].q.size;
+    return size;
+}
+
+int audio_mix_has_enough_packets(AudioMix *m, AVFormatContext *ic)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+    {
+        AudioTrack *t = &m->tracks[i];
+
+        if (!stream_has_enough_packets(ic->streams[t->stream_index], t->stream_index, &t->q))
+            return 0;
+    }
+    return 1;
+}
+
+/* every track decoded to the end and handed to the graph */
+int audio_mix_finished(AudioMix *m)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+    {
+        AudioTrack *t = &m->tracks[i];
+
+        if (t->dec.finished != t->q.serial || frame_queue_nb_remaining(&t->fq))
+            return 0;
+    }
+    return 1;
+}
+
+/* the next frame of the current serial, older ones are dropped */
+static Frame *audio_track_peek(AudioTrack *t)
+{
+    while (frame_queue_nb_remaining(&t->fq) > 0)
+    {
+        Frame *af = frame_queue_peek(&t->fq);
+
+        if (af->serial == t->q.serial)
+            return af;
+        frame_queue_next(&t->fq);
+    }
+    return NULL;
+}
+
+static int audio_track_format_changed(AudioTrack *t, AVFrame *frame)
+{
+    return t->freq != frame->sample_rate || t->fmt != frame->format ||
+        av_channel_layout_compare(&t->ch_layout, &frame->ch_layout);
+}
+
+/*
+ * main_src -> volume@t0 -+
+ * track 1  -> volume@t1 -+-> amix -> out
+ * ...
+ * the graph keeps the length of the main stream, a track that ends early is silence.
+ */
+int audio_mix_configure(AudioMix *m, AVFilterGraph *graph, AVFilterContext *main_src, AVFilterContext **out)
+{
+    AVFilterContext *mix, *volume, *src;
+    AVBPrint bp;
+    char args[256], name[32];
+    int i, ret;
+
+    snprintf(args, sizeof(args), "inputs=%d:duration=first:dropout_transition=0:normalize=0", m->nb_tracks + 1);
+    if ((ret = avfilter_graph_create_filter(&mix, avfilter_get_by_name("amix"), "ffplay_amix", args, NULL, graph)) < 0)
+        return ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    for (i = 0; i <= m->nb_tracks; i++)
+    {
+        src = main_src;
+        if (i)
+        {
+            AudioTrack *t = &m->tracks[i - 1];
+            Frame *af = audio_track_peek(t);
+
+            /* the parameters of the first frame waiting, the decoder ones before that */
+            if (af && audio_track_format_changed(t, af->frame))
+            {
+                t->freq = af->frame->sample_rate;
+                t->fmt = af->frame->format;
+                if ((ret = av_channel_layout_copy(&t->ch_layout, &af->frame->ch_layout)) < 0)
+                    goto end;
+            }
+            av_bprint_clear(&bp);
+            av_channel_layout_describe_bprint(&t->ch_layout, &bp);
+            snprintf(args, sizeof(args), "sample_rate=%d:sample_fmt=%s:time_base=%d/%d:channel_layout=%s",
+                t->freq, av_get_sample_fmt_name(t->fmt), 1, t->freq, bp.str);
+            snprintf(name, sizeof(name), "ffplay_abuffer_t%d", i);
+            if ((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("abuffer"), name, args, NULL, graph)) < 0)
+                goto end;
+            t->src = src;
+            t->closed = 0;
+        }
+
+        snprintf(name, sizeof(name), "volume@t%d", i);
+        snprintf(args, sizeof(args), "volume=%f", SDL_AtomicGet(&m->gains[i]) / 100.0);
+        if ((ret = avfilter_graph_create_filter(&volume, avfilter_get_by_name("volume"), name, args, NULL, graph)) < 0)
+            goto end;
+        if ((ret = avfilter_link(src, 0, volume, 0)) < 0 || (ret = avfilter_link(volume, 0, mix, i)) < 0)
+            goto end;
+    }
+    /* the gains are in the graph now */
+    SDL_AtomicSet(&m->gains_changed, 0);
+    *out = mix;
+end:
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+/* a track sends frames the graph was not built for */
+int audio_mix_changed(AudioMix *m)
+{
+    int i;
+
+    for (i = 0; i < m->nb_tracks; i++)
+    {
+        AudioTrack *t = &m->tracks[i];
+        Frame *af = audio_track_peek(t);
+
+        if (af && audio_track_format_changed(t, af->frame))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * hands the decoded frames of the tracks to the graph without waiting,
+ * frames that end before start, where the main stream begins in the graph, are dropped
+ */
+int audio_mix_feed(AudioMix *m, double start)
+{
+    int i, ret;
+
+    for (i = 0; i < m->nb_tracks; i++)
+    {
+        AudioTrack *t = &m->tracks[i];
+        Frame *af;
+
+        while (!t->closed && (af = audio_track_peek(t)))
+        {
+            /* the graph is rebuilt with the next frame of the main stream */
+            if (audio_track_format_changed(t, af->frame))
+                break;
+            if (isnan(start) || isnan(af->pts) || af->pts + af->duration > start)
+            {
+                if ((ret = av_buffersrc_add_frame(t->src, af->frame)) < 0)
+                    return ret;
+            }
+            frame_queue_next(&t->fq);
+        }
+
+        /* amix waits for every input, a track that ended must say so */
+        if (!t->closed && t->dec.finished == t->q.serial && !frame_queue_nb_remaining(&t->fq))
+        {
+            if ((ret = av_buffersrc_add_frame(t->src, NULL)) < 0)
+                return ret;
+            t->closed = 1;
+        }
+    }
+    return 0;
+}
+
+void audio_mix_update_gains(AudioMix *m, AVFilterGraph *graph)
+{
+    char name[32], arg[32];
+    int i;
+
+    if (!SDL_AtomicSet(&m->gains_changed, 0))
+        return;
+    for (i = 0; i <= m->nb_tracks; i++)
+    {
+        snprintf(name, sizeof(name), "volume@t%d", i);
+        snprintf(arg, sizeof(arg), "%f", SDL_AtomicGet(&m->gains[i]) / 100.0);
+        avfilter_graph_send_command(graph, name, "volume", arg, NULL, 0, 0);
+    }
+}
+
+void audio_mix_set_gain(AudioMix *m, int track, int percent)
+{
+    if (track < 0 || track >= AUDIO_MIX_MAX_TRACKS)
+        return;
+    SDL_AtomicSet(&m->gains[track], av_clip(percent, 0, AUDIO_MIX_GAIN_MAX));
+    SDL_AtomicSet(&m->gains_changed, 1);
+}
+
+/* only the track after the loudest one is heard, returns it */
+int audio_mix_solo_next(AudioMix *m)
+{
+    int i, solo = 0, gain = -1;
+
+    for (i = 0; i <= m->nb_tracks; i++)
+    {
+        if (SDL_AtomicGet(&m->gains[i]) > gain)
+        {
+            gain = SDL_AtomicGet(&m->gains[i]);
+            solo = i;
+        }
+    }
+    solo = (solo + 1) % (m->nb_tracks + 1);
+    for (i = 0; i <= m->nb_tracks; i++)
+        audio_mix_set_gain(m, i, i == solo ? 100 : 0);
+    return solo;
+}
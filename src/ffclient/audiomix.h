@@ -0,0 +1,81 @@
+#ifndef FFCLIENT_AUDIOMIX_H
+#define FFCLIENT_AUDIOMIX_H
+
+#include <inttypes.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#include "packet.h"
+#include "frame.h"
+#include "decoder.h"
+
+/* the main audio stream included */
+#define AUDIO_MIX_MAX_TRACKS 8
+#define AUDIO_MIX_GAIN_MAX 400
+
+/* an audio stream decoded next to the main one and mixed into it */
+typedef struct AudioTrack
+{
+    int stream_index;
+    PacketQueue q;
+    FrameQueue fq;
+    Decoder dec;
+    /* input of the audio graph, other frame parameters rebuild the graph */
+    AVFilterContext *src;
+    int freq;
+    AVChannelLayout ch_layout;
+    enum AVSampleFormat fmt;
+    int closed; /* the decoder drained, the graph got EOF */
+} AudioTrack;
+
+typedef struct AudioMix
+{
+    /* requested streams, all other audio streams when all is set */
+    int streams[AUDIO_MIX_MAX_TRACKS - 1];
+    int nb_streams;
+    int all;
+
+    AudioTrack tracks[AUDIO_MIX_MAX_TRACKS - 1];
+    int nb_tracks;
+
+    /* percent, 0 is the main stream and 1.. the tracks in the order they were opened */
+    SDL_atomic_t gains[AUDIO_MIX_MAX_TRACKS];
+    SDL_atomic_t gains_changed;
+} AudioMix;
+
+void audio_mix_init(AudioMix *m);
+int audio_mix_parse_streams(AudioMix *m, const char *list);
+void audio_mix_parse_gains(AudioMix *m, const char *list);
+
+/* number of tracks opened next to main_stream */
+int audio_mix_open(AudioMix *m, AVFormatContext *ic, int main_stream, const char *codec_name,
+    int threads, SDL_cond *empty_queue_cond);
+void audio_mix_close(AudioMix *m, AVFormatContext *ic);
+AudioTrack *audio_mix_track(AudioMix *m, int stream_index);
+
+/* read thread */
+void audio_mix_flush(AudioMix *m);
+void audio_mix_put_nullpackets(AudioMix *m, AVPacket *pkt);
+int audio_mix_queue_size(AudioMix *m);
+int audio_mix_has_enough_packets(AudioMix *m, AVFormatContext *ic);
+int audio_mix_finished(AudioMix *m);
+
+/* audio decoder thread */
+int audio_mix_configure(AudioMix *m, AVFilterGraph *graph, AVFilterContext *main_src, AVFilterContext **out);
+int audio_mix_changed(AudioMix *m);
+int audio_mix_feed(AudioMix *m, double start);
+void audio_mix_update_gains(AudioMix *m, AVFilterGraph *graph);
+
+/* any thread */
+void audio_mix_set_gain(AudioMix *m, int track, int percent);
+int audio_mix_solo_next(AudioMix *m);
+
+#endif
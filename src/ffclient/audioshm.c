@@ -0,0 +1,142 @@
+#include "audioshm.h"
+
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+
+/* periods the ring holds, the host may fall behind this far */
+#define AUDIO_SHM_PERIODS 4
+
+/*
+ * audio output to shared memory
+ *
+ * no SDL device is opened, the resampled PCM goes into a ring buffer in shared memory
+ * and the host mixes it.
+ * The host writes the position it played up to back into the header, the audio clock is
+ * the write position minus what the host has not played yet,
+ * so audio is still the master clock. Many players need just one audio device in the host.
+ */
+static int audio_shm_thread(void *arg)
+{
+    AudioShm *shm = arg;
+    AudioShmHeader *h = shm->header;
+    /* a quarter period, the host reads in its own block size */
+    unsigned wait = FFMAX((int64_t)shm->period * 250000 / h->sample_rate, 1000);
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    while (!SDL_AtomicGet(&shm->abort))
+    {
+        uint32_t w = h->write;
+
+        /* paused like an SDL device, the host plays out what it has */
+        if (SDL_AtomicGet(&shm->paused))
+        {
+            SDL_LockMutex(shm->mutex);
+            while (SDL_AtomicGet(&shm->paused) && !SDL_AtomicGet(&shm->abort))
+                SDL_CondWait(shm->cond, shm->mutex);
+            SDL_UnlockMutex(shm->mutex);
+            continue;
+        }
+        /* the host cannot signal, poll until it played a period */
+        if ((int)(w - h->read) > (int)(h->frames - shm->period))
+        {
+            av_usleep(wait);
+            continue;
+        }
+
+        SDL_MemoryBarrierAcquire();
+        shm->callback(shm->opaque, shm->data + (w & (h->frames - 1)) * h->frame_size,
+            shm->period * h->frame_size);
+        SDL_MemoryBarrierRelease();
+        h->write = w + shm->period;
+    }
+    return 0;
+}
+
+int audio_shm_open(AudioShm *shm, int session, char *name, SDL_AudioCallback callback, void *opaque,
+    int sample_rate, int channels, int format, int period)
+{
+    AudioShmHeader *h;
+    int frame_size = channels * (format == AUDIO_SHM_FLT ? 4 : 2);
+    int frames = period;
+
+    memset(shm, 0, sizeof(*shm));
+    if (sample_rate <= 0 || channels <= 0 || period <= 0 || (period & (period - 1)))
+        return AVERROR(EINVAL);
+    while (frames < AUDIO_SHM_PERIODS * period)
+        frames <<= 1;
+
+    if (socket_send_audio_mem(session, &shm->mem, name, AUDIO_SHM_HEADER_SIZE + frames * frame_size) < 0)
+        return AVERROR(EIO);
+
+    h = shm->header = shm->mem.ptr;
+    shm->data = (uint8_t *)shm->mem.ptr + AUDIO_SHM_HEADER_SIZE;
+    shm->period = period;
+    shm->callback = callback;
+    shm->opaque = opaque;
+
+    memset(h, 0, AUDIO_SHM_HEADER_SIZE);
+    memset(shm->data, 0, frames * frame_size);
+    h->version = AUDIO_SHM_VERSION;
+    h->header_size = AUDIO_SHM_HEADER_SIZE;
+    h->sample_rate = sample_rate;
+    h->channels = channels;
+    h->format = format;
+    h->frame_size = frame_size;
+    h->frames = frames;
+    /* the host checks the magic last */
+    SDL_MemoryBarrierRelease();
+    h->magic = AUDIO_SHM_MAGIC;
+
+    SDL_AtomicSet(&shm->paused, 1);
+    if (!(shm->mutex = SDL_CreateMutex()) || !(shm->cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        audio_shm_close(shm);
+        return AVERROR(ENOMEM);
+    }
+    if (!(shm->tid = SDL_CreateThread(audio_shm_thread, "audio_shm", shm)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        audio_shm_close(shm);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void audio_shm_pause(AudioShm *shm, int pause)
+{
+    SDL_LockMutex(shm->mutex);
+    SDL_AtomicSet(&shm->paused, pause);
+    SDL_CondSignal(shm->cond);
+    SDL_UnlockMutex(shm->mutex);
+}
+
+int audio_shm_queued(AudioShm *shm)
+{
+    AudioShmHeader *h = shm->header;
+    int queued = (int)(h->write - h->read);
+
+    return FFMAX(queued, 0) + (int)FFMIN(h->delay, h->frames * 4);
+}
+
+void audio_shm_close(AudioShm *shm)
+{
+    if (shm->tid)
+    {
+        SDL_LockMutex(shm->mutex);
+        SDL_AtomicSet(&shm->abort, 1);
+        SDL_CondSignal(shm->cond);
+        SDL_UnlockMutex(shm->mutex);
+        SDL_WaitThread(shm->tid, NULL);
+    }
+    if (shm->cond)
+        SDL_DestroyCond(shm->cond);
+    if (shm->mutex)
+        SDL_DestroyMutex(shm->mutex);
+    share_mem_close(&shm->mem);
+    memset(shm, 0, sizeof(*shm));
+}
@@ -0,0 +1,69 @@
+#ifndef FFCLIENT_AUDIOSHM_H
+#define FFCLIENT_AUDIOSHM_H
+
+#include <inttypes.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#include "socket.h"
+
+#define AUDIO_SHM_MAGIC 0x4d505346 /* "FSPM" */
+#define AUDIO_SHM_VERSION 1
+#define AUDIO_SHM_HEADER_SIZE 64
+
+/* AudioShmHeader.format, samples are interleaved in host byte order */
+#define AUDIO_SHM_S16 1
+#define AUDIO_SHM_FLT 2
+
+/*
+ * at the start of the shared block, the samples follow at header_size.
+ * Cursors count sample frames and wrap around at 2^32, the sample frame
+ * at cursor c is at (c & (frames - 1)) * frame_size.
+ */
+typedef struct AudioShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t format;
+    uint32_t frame_size;
+    uint32_t frames;          /* ring capacity, a power of two */
+    volatile uint32_t write;  /* frames written, only ffclient moves it */
+    volatile uint32_t read;   /* frames played, only the host moves it */
+    volatile uint32_t delay;  /* frames the host still buffers after read, 0 if unknown */
+} AudioShmHeader;
+
+/*
+ * instead of an SDL device the samples are written into a ring in shared memory,
+ * the host mixes them and reports how far it played
+ */
+typedef struct AudioShm
+{
+    ShareMem mem;
+    AudioShmHeader *header;
+    uint8_t *data;
+    int period; /* frames per callback, divides the capacity */
+    SDL_AudioCallback callback;
+    void *opaque;
+    SDL_Thread *tid;
+    SDL_atomic_t abort;
+    SDL_atomic_t paused;
+    /* the thread sleeps on cond while paused */
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+} AudioShm;
+
+int audio_shm_open(AudioShm *shm, int session, char *name, SDL_AudioCallback callback, void *opaque,
+    int sample_rate, int channels, int format, int period);
+void audio_shm_pause(AudioShm *shm, int pause);
+/* sample frames written but not heard yet */
+int audio_shm_queued(AudioShm *shm);
+void audio_shm_close(AudioShm *shm);
+
+#endif
@@ -1,4 +1,7 @@
 #include "decoder.h"
+#include "pool.h"
+
+#include <libavutil/time.h>
 
 int decoder_reorder_pts = -1;
 
@@ -13,12 +16,44 @@ int decoder_init(Decoder *d, AVCodecContext *avctx, PacketQueue *queue, SDL_cond
     d->empty_queue_cond = empty_queue_cond;
     d->start_pts = AV_NOPTS_VALUE;
     d->pkt_serial = -1;
+    d->priority = POOL_PRIORITY_NONE;
+    d->skip_frame = AVDISCARD_DEFAULT;
+    d->skip_loop_filter = AVDISCARD_DEFAULT;
+    d->preroll_pts = AV_NOPTS_VALUE;
+    d->preroll_serial = -1;
     return 0;
 }
 
+/* coming back from keyframes only waits for the next keyframe, the missing references would show as garbage */
+static void decoder_apply_discard(Decoder *d)
+{
+    int skip_frame = d->skip_frame;
+
+    /* with an accurate seek the frames before the target are not shown, only referenced ones need decoding.
+     * The frame whose display time covers the target is decoded, an unknown duration comes from the
+     * frame rate, and without that the frame is decoded as usual */
+    if (d->pkt_serial == d->preroll_serial && d->pkt->pts != AV_NOPTS_VALUE && d->pkt->pts < d->preroll_pts)
+    {
+        int64_t duration = d->pkt->duration;
+
+        if (duration <= 0 && d->avctx->framerate.num > 0 && d->avctx->framerate.den > 0)
+            duration = av_rescale_q(1, av_inv_q(d->avctx->framerate), d->avctx->pkt_timebase);
+        if (duration > 0 && d->pkt->pts + duration <= d->preroll_pts)
+            skip_frame = FFMAX(skip_frame, AVDISCARD_NONREF);
+    }
+
+    if (d->avctx->skip_frame >= AVDISCARD_NONKEY && skip_frame < AVDISCARD_NONKEY &&
+        !(d->pkt->flags & AV_PKT_FLAG_KEY))
+        skip_frame = d->avctx->skip_frame;
+
+    d->avctx->skip_frame = skip_frame;
+    d->avctx->skip_loop_filter = d->skip_loop_filter;
+}
+
 int decoder_decode_frame(Decoder *d, AVFrame *frame)
 {
     int ret = AVERROR(EAGAIN);
+    int64_t start;
 
     for (;;)
     {
@@ -32,7 +67,11 @@ int decoder_decode_frame(Decoder *d, AVFrame *frame)
                 switch (d->avctx->codec_type)
                 {
                 case AVMEDIA_TYPE_VIDEO:
+                    pool_slot_acquire(d->priority);
+                    start = av_gettime_relative();
                     ret = avcodec_receive_frame(d->avctx, frame);
+                    d->busy_time += av_gettime_relative() - start;
+                    pool_slot_release(d->priority);
                     if (ret >= 0)
                     {
                         if (decoder_reorder_pts == -1)
@@ -110,7 +149,14 @@ int decoder_decode_frame(Decoder *d, AVFrame *frame)
             fd->pkt_pos = d->pkt->pos;
         }
 
-        if (avcodec_send_packet(d->avctx, d->pkt) == AVERROR(EAGAIN))
+        decoder_apply_discard(d);
+
+        pool_slot_acquire(d->priority);
+        start = av_gettime_relative();
+        ret = avcodec_send_packet(d->avctx, d->pkt);
+        d->busy_time += av_gettime_relative() - start;
+        pool_slot_release(d->priority);
+        if (ret == AVERROR(EAGAIN))
         {
             av_log(d->avctx, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
             d->packet_pending = 1;
@@ -21,6 +21,14 @@ typedef struct Decoder
     int64_t next_pts;
     AVRational next_pts_tb;
     SDL_Thread *decoder_tid;
+    int priority; /* core budget priority, POOL_PRIORITY_NONE to bypass */
+    /* requested discard levels, applied by the decoder thread before each packet */
+    int skip_frame;
+    int skip_loop_filter;
+    int64_t busy_time; /* microseconds spent inside the codec */
+    /* packets of this serial before preroll_pts are only decoded as references */
+    int64_t preroll_pts;
+    int preroll_serial;
 } Decoder;
 
 int decoder_init(Decoder *d, AVCodecContext *avctx, PacketQueue *queue, SDL_cond *empty_queue_cond);
@@ -0,0 +1,272 @@
+#include "dirty.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DIRTY_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DIRTY_NEON 1
+#endif
+
+/*
+ * dirty region detection
+ *
+ * the decoded picture is cut into DIRTY_BLOCK_SIZE squares, each gets a Fletcher style checksum
+ * (16 bytes at a time in 4 parallel 32 bit sums, so SSE2/NEON fit directly) compared with the last picture.
+ * An identical picture is not converted at all, others only in the rows that changed.
+ */
+static void dirty_hash_update(DirtyHash *h, const uint8_t *p, int n)
+{
+    uint8_t tail[16];
+
+#if DIRTY_SSE2
+    __m128i a = _mm_loadu_si128((const __m128i *)h->a);
+    __m128i b = _mm_loadu_si128((const __m128i *)h->b);
+    for (; n >= 16; n -= 16, p += 16)
+    {
+        a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i *)p));
+        b = _mm_add_epi32(b, a);
+    }
+    _mm_storeu_si128((__m128i *)h->a, a);
+    _mm_storeu_si128((__m128i *)h->b, b);
+#elif DIRTY_NEON
+    uint32x4_t a = vld1q_u32(h->a);
+    uint32x4_t b = vld1q_u32(h->b);
+    for (; n >= 16; n -= 16, p += 16)
+    {
+        a = vaddq_u32(a, vreinterpretq_u32_u8(vld1q_u8(p)));
+        b = vaddq_u32(b, a);
+    }
+    vst1q_u32(h->a, a);
+    vst1q_u32(h->b, b);
+#endif
+
+    /* scalar path, also takes the last partial group padded with zeros */
+    while (n > 0)
+    {
+        uint32_t v[4];
+        int i;
+
+        if (n < 16)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, n);
+            p = tail;
+            n = 16;
+        }
+        memcpy(v, p, 16);
+        for (i = 0; i < 4; i++)
+        {
+            h->a[i] += v[i];
+            h->b[i] += h->a[i];
+        }
+        n -= 16;
+        p += 16;
+    }
+}
+
+void dirty_free(DirtyMap *map)
+{
+    int p;
+
+    for (p = 0; p < DIRTY_MAX_PLANES; p++)
+        av_freep(&map->col_offset[p]);
+    av_freep(&map->cur);
+    av_freep(&map->prev);
+    av_freep(&map->dirty);
+    memset(map, 0, sizeof(*map));
+}
+
+/* the next frame is reported as fully dirty */
+void dirty_reset(DirtyMap *map)
+{
+    map->valid = 0;
+}
+
+static int dirty_alloc(DirtyMap *map, const AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int nb_blocks, p, c;
+
+    dirty_free(map);
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        return AVERROR(EINVAL);
+
+    map->width = frame->width;
+    map->height = frame->height;
+    map->format = frame->format;
+    map->cols = (frame->width + DIRTY_BLOCK_SIZE - 1) / DIRTY_BLOCK_SIZE;
+    map->rows = (frame->height + DIRTY_BLOCK_SIZE - 1) / DIRTY_BLOCK_SIZE;
+    map->nb_planes = FFMIN(av_pix_fmt_count_planes(frame->format), DIRTY_MAX_PLANES);
+    nb_blocks = map->cols * map->rows;
+
+    map->cur = av_calloc(nb_blocks, sizeof(*map->cur));
+    map->prev = av_calloc(nb_blocks, sizeof(*map->prev));
+    map->dirty = av_calloc(nb_blocks, 1);
+    if (!map->cur || !map->prev || !map->dirty)
+        goto fail;
+
+    for (p = 0; p < map->nb_planes; p++)
+    {
+        int linesize = av_image_get_linesize(frame->format, frame->width, p);
+
+        if (linesize < 0)
+            goto fail;
+        map->plane_shift[p] = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+        map->col_offset[p] = av_malloc_array(map->cols + 1, sizeof(int));
+        if (!map->col_offset[p])
+            goto fail;
+        /* map the block columns onto bytes, works for planar and packed formats */
+        for (c = 0; c < map->cols; c++)
+            map->col_offset[p][c] = (int)((int64_t)c * DIRTY_BLOCK_SIZE * linesize / frame->width);
+        map->col_offset[p][map->cols] = linesize;
+    }
+    return 0;
+fail:
+    dirty_free(map);
+    return AVERROR(ENOMEM);
+}
+
+/* returns the number of blocks that changed since the previous frame */
+int dirty_update(DirtyMap *map, const AVFrame *frame)
+{
+    DirtyHash *tmp;
+    int nb_blocks, nb_dirty = 0;
+    int p, y, c, i, ret;
+
+    if (frame->width != map->width || frame->height != map->height || frame->format != map->format)
+    {
+        if ((ret = dirty_alloc(map, frame)) < 0)
+            return ret;
+    }
+
+    nb_blocks = map->cols * map->rows;
+    memset(map->cur, 0, nb_blocks * sizeof(*map->cur));
+
+    /* walk the planes row by row so each line is read once */
+    for (p = 0; p < map->nb_planes; p++)
+    {
+        int shift = map->plane_shift[p];
+        int height = AV_CEIL_RSHIFT(frame->height, shift);
+        const int *offset = map->col_offset[p];
+
+        for (y = 0; y < height; y++)
+        {
+            const uint8_t *line = frame->data[p] + (ptrdiff_t)y * frame->linesize[p];
+            DirtyHash *row = map->cur + FFMIN((y << shift) / DIRTY_BLOCK_SIZE, map->rows - 1) * map->cols;
+
+            for (c = 0; c < map->cols; c++)
+                dirty_hash_update(&row[c], line + offset[c], offset[c + 1] - offset[c]);
+        }
+    }
+
+    for (i = 0; i < nb_blocks; i++)
+    {
+        map->dirty[i] = !map->valid || memcmp(&map->cur[i], &map->prev[i], sizeof(DirtyHash));
+        nb_dirty += map->dirty[i];
+    }
+
+    tmp = map->prev;
+    map->prev = map->cur;
+    map->cur = tmp;
+    map->valid = 1;
+
+    return nb_dirty;
+}
+
+/*
+ * one rectangle per run of block rows with overlapping dirty spans,
+ * top to bottom, in source pixels. Too many rectangles fall back to the bounding box.
+ */
+int dirty_rects(const DirtyMap *map, DirtyRect *rects, int max_rects)
+{
+    int nb_rects = 0, open = 0;
+    int r, c;
+
+    for (r = 0; r < map->rows; r++)
+    {
+        const uint8_t *dirty = map->dirty + r * map->cols;
+        int c0 = -1, c1 = -1;
+        int x, w, y, h;
+
+        for (c = 0; c < map->cols; c++)
+        {
+            if (dirty[c])
+            {
+                if (c0 < 0)
+                    c0 = c;
+                c1 = c;
+            }
+        }
+        if (c0 < 0)
+        {
+            open = 0;
+            continue;
+        }
+
+        x = c0 * DIRTY_BLOCK_SIZE;
+        w = FFMIN((c1 + 1) * DIRTY_BLOCK_SIZE, map->width) - x;
+        y = r * DIRTY_BLOCK_SIZE;
+        h = FFMIN(y + DIRTY_BLOCK_SIZE, map->height) - y;
+
+        if (open && x <= rects[nb_rects - 1].x + rects[nb_rects - 1].w &&
+            x + w >= rects[nb_rects - 1].x)
+        {
+            DirtyRect *last = &rects[nb_rects - 1];
+            int x1 = FFMAX(last->x + last->w, x + w);
+
+            last->x = FFMIN(last->x, x);
+            last->w = x1 - last->x;
+            last->h = y + h - last->y;
+        }
+        else if (nb_rects < max_rects)
+        {
+            rects[nb_rects].x = x;
+            rects[nb_rects].y = y;
+            rects[nb_rects].w = w;
+            rects[nb_rects].h = h;
+            nb_rects++;
+            open = 1;
+        }
+        else
+        {
+            nb_rects = -1;
+            open = 0;
+            break;
+        }
+    }
+
+    if (nb_rects < 0)
+    {
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = 0, y1 = 0;
+
+        for (r = 0; r < map->rows; r++)
+        {
+            for (c = 0; c < map->cols; c++)
+            {
+                if (map->dirty[r * map->cols + c])
+                {
+                    x0 = FFMIN(x0, c * DIRTY_BLOCK_SIZE);
+                    y0 = FFMIN(y0, r * DIRTY_BLOCK_SIZE);
+                    x1 = FFMAX(x1, FFMIN((c + 1) * DIRTY_BLOCK_SIZE, map->width));
+                    y1 = FFMAX(y1, FFMIN((r + 1) * DIRTY_BLOCK_SIZE, map->height));
+                }
+            }
+        }
+        rects[0].x = x0;
+        rects[0].y = y0;
+        rects[0].w = x1 - x0;
+        rects[0].h = y1 - y0;
+        nb_rects = 1;
+    }
+    return nb_rects;
+}
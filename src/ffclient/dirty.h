@@ -0,0 +1,52 @@
+#ifndef FFCLIENT_DIRTY_H
+#define FFCLIENT_DIRTY_H
+
+#include <inttypes.h>
+
+#include <libavutil/frame.h>
+
+#define DIRTY_BLOCK_SIZE 32
+#define DIRTY_MAX_PLANES 4
+#define DIRTY_MAX_RECTS 64
+
+/*
+ * Optional table the host can ask for, written right after the pixels:
+ *   u32 sequence, u32 count, count * (u16 x, u16 y, u16 w, u16 h)
+ * sequence is bumped last, once the pixels and the list are in place.
+ */
+#define DIRTY_HEADER_SIZE (8 + DIRTY_MAX_RECTS * 8)
+
+typedef struct DirtyRect
+{
+    int x, y, w, h;
+} DirtyRect;
+
+/* running sums of one block, compared with the previous frame */
+typedef struct DirtyHash
+{
+    uint32_t a[4];
+    uint32_t b[4];
+} DirtyHash;
+
+typedef struct DirtyMap
+{
+    int width;
+    int height;
+    int format;
+    int cols;
+    int rows;
+    int nb_planes;
+    int plane_shift[DIRTY_MAX_PLANES];
+    int *col_offset[DIRTY_MAX_PLANES]; /* byte offset of each block column, cols + 1 entries */
+    DirtyHash *cur;
+    DirtyHash *prev;
+    uint8_t *dirty;
+    int valid;
+} DirtyMap;
+
+int dirty_update(DirtyMap *map, const AVFrame *frame);
+int dirty_rects(const DirtyMap *map, DirtyRect *rects, int max_rects);
+void dirty_reset(DirtyMap *map);
+void dirty_free(DirtyMap *map);
+
+#endif
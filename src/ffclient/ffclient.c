@@ -12,11 +12,13 @@
 #include <libavutil/mathematics.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/dict.h>
 #include <libavutil/fifo.h>
 #include <libavutil/parseutils.h>
 #include <libavutil/samplefmt.h>
 #include <libavutil/time.h>
+#include <libavutil/random_seed.h>
 #include <libavutil/bprint.h>
 #include <libavformat/avformat.h>
 #include <libavdevice/avdevice.h>
@@ -44,6 +46,8 @@
 #include "video.h"
 #include "utils.h"
 #include "socket.h"
+#include "pool.h"
+#include "mosaic.h"
 #include "ffclient.h"
 
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
@@ -62,6 +66,9 @@
 /* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
 #define AUDIO_DIFF_AVG_NB 20
 
+/* audio converted ahead of the callback, in milliseconds */
+#define AUDIO_RING_MS 200
+
 /* polls for possible required screen refresh at least this often, should be less than 1/fps */
 #define REFRESH_RATE 0.01
 
@@ -69,20 +76,34 @@
 
 #define USE_ONEPASS_SUBTITLE_RENDER 1
 
+/* a frame ending this fraction of its duration after an accurate seek target still counts as before it */
+#define SEEK_TOLERANCE 0.01
+
+/* default memory budget of the step cache per session */
+#define STEP_CACHE_SIZE (64 * 1024 * 1024)
+
+/* looping clips up to this size and duration are replayed from memory */
+#define LOOP_CACHE_SIZE (256 * 1024 * 1024)
+#define LOOP_CACHE_MAX (60 * (int64_t)AV_TIME_BASE)
+
+/* playback rate limits, from this rate on only keyframes are decoded */
+#define SPEED_MIN 0.25
+#define SPEED_MAX 64.0
+#define SCAN_SPEED_MIN 4.0
+/* keyframes picked from the index while scanning, per second of wall time */
+#define SCAN_MAX_RATE 25
+/* above this many pictures per second of wall time, faster playback skips non-reference frames */
+#define SPEED_MAX_FPS 60
+
+/* backoff between two reconnect attempts, in microseconds */
+#define RECONNECT_DELAY_MIN 250000
+#define RECONNECT_DELAY_MAX 30000000
+
 /* options specified by the user */
 
 int need_exit = 0;
 
-static int img_max_width = 0;
-static int img_max_height = 0;
-static uint8_t send = 0;
-static int eof;
-static AVBufferRef* hw_device_ctx = NULL;
-static enum AVPixelFormat hw_pix_fmt;
-static int img_width = 0;
-static int img_height = 0;
 static const char* wanted_stream_spec[AVMEDIA_TYPE_NB] = { 0 };
-static int seek_by_bytes = -1;
 static float seek_interval = 10;
 static int borderless;
 static int alwaysontop;
@@ -97,9 +118,7 @@ static int lowres = 0;
 static int autoexit;
 static int exit_on_keydown;
 static int exit_on_mousedown;
-static int loop = 1;
 static int framedrop = -1;
-static int infinite_buffer = -1;
 static enum ShowMode show_mode = SHOW_MODE_NONE;
 static const char* audio_codec_name;
 static const char* subtitle_codec_name;
@@ -113,19 +132,36 @@ static char* afilters = NULL;
 static int autorotate = 1;
 static int find_stream_info = 1;
 static int filter_nbthreads = 0;
+static int core_budget = 0;
 
 AVDictionary* sws_dict;
 AVDictionary* swr_opts;
 AVDictionary* format_opts, * codec_opts;
-struct SwsContext* sws_ctx = NULL;
 
-uint8_t* sws_dst_data[4];
-int sws_dst_linesize[4];
+#define MAX_SESSIONS 256
 
-/* current context */
-static int64_t audio_callback_time;
+/* all running sessions, only touched from the main thread */
+static VideoState* sessions[MAX_SESSIONS];
+static int nb_sessions = 0;
+/* started without an input, sessions come from the control socket */
+static int server_mode = 0;
+
+/* the main loop sleeps on this when every session is idle */
+static SDL_mutex* wake_mutex;
+static SDL_cond* wake_cond;
+static int wake_pending;
 
 #define FF_QUIT_EVENT (SDL_USEREVENT + 2)
+#define FF_COMMAND_EVENT (SDL_USEREVENT + 3)
+#define FF_SWITCH_EVENT (SDL_USEREVENT + 4)
+
+typedef struct SessionCommand
+{
+    int session;
+    int cmd;
+    int size;
+    uint8_t* data;
+} SessionCommand;
 
 static const struct TextureFormatEntry
 {
@@ -154,16 +190,18 @@ static const struct TextureFormatEntry
     {AV_PIX_FMT_NONE, SDL_PIXELFORMAT_UNKNOWN},
 };
 
-static void do_exit(VideoState* is)
+static void do_exit(void)
 {
-    if (is)
+    while (nb_sessions > 0)
     {
-        stream_close(is);
+        stream_close(sessions[--nb_sessions]);
     }
-    if (socket_send || socket_conn)
+    if (socket_conn)
     {
         socket_stop();
     }
+    mosaic_uninit();
+    pool_uninit();
     av_dict_free(&swr_opts);
     av_dict_free(&sws_dict);
     av_dict_free(&format_opts);
@@ -174,102 +212,399 @@ static void do_exit(VideoState* is)
     exit(0);
 }
 
-static void video_image_display(VideoState* is)
+/* ask the main thread to close the session */
+static void push_quit_event(VideoState* is)
 {
-    Frame* vp;
-    Frame* sp = NULL;
+    SDL_Event event;
 
-    vp = frame_queue_peek_last(&is->pictq);
+    event.type = FF_QUIT_EVENT;
+    event.user.code = is->id;
+    event.user.data1 = is;
+    SDL_PushEvent(&event);
+    ffclient_wakeup();
+}
+
+/* pick the strongest discard level any of the requests asks for */
+static void update_video_discard(VideoState* is)
+{
+    int skip_frame = AVDISCARD_DEFAULT;
+    int skip_loop_filter = AVDISCARD_DEFAULT;
 
-    if (!vp->uploaded)
+    if ((is->hidden && is->hidden_keyonly) || is->scan)
+        skip_frame = FFMAX(skip_frame, AVDISCARD_NONKEY);
+
+    if ((is->max_fps > 0 || is->speed > 1.0) && is->video_st)
+    {
+        AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, NULL);
+
+        /* with IBBP two of three frames are non-reference, only drop them when the cap is below a third */
+        if (is->max_fps > 0 && frame_rate.num && frame_rate.den && av_q2d(frame_rate) >= 3 * is->max_fps)
+            skip_frame = FFMAX(skip_frame, AVDISCARD_NONREF);
+        /* at 2x and more most pictures would be dropped as late anyway, do not decode them */
+        if (is->speed > 1.0 && frame_rate.num && frame_rate.den && av_q2d(frame_rate) * is->speed > SPEED_MAX_FPS)
+            skip_frame = FFMAX(skip_frame, AVDISCARD_NONREF);
+    }
+
+    skip_controller_apply(&is->skip, &skip_frame, &skip_loop_filter);
+
+    is->viddec.skip_frame = skip_frame;
+    is->viddec.skip_loop_filter = skip_loop_filter;
+}
+
+/* rows around a dirty block that the bilinear scaler also touches */
+#define DIRTY_PAD 2
+
+/* convert only the output rows covering the dirty rectangles, rects are rewritten in output pixels */
+static int video_convert_rects(VideoState* is, AVFrame* src, DirtyRect* rects, int nb_rects)
+{
+    AVFrame* dst = is->sws_dst;
+    int align = sws_receive_slice_alignment(is->sws_ctx);
+    int done = 0;
+    int ret, i;
+
+    ret = sws_frame_start(is->sws_ctx, dst, src);
+    if (ret < 0)
+        return ret;
+    ret = sws_send_slice(is->sws_ctx, 0, src->height);
+
+    for (i = 0; i < nb_rects && ret >= 0; i++)
     {
-        AVFrame* sw_frame = NULL;
-        if (vp->frame->hw_frames_ctx)
+        DirtyRect* r = &rects[i];
+        int x0 = av_rescale(r->x, dst->width, src->width) - DIRTY_PAD;
+        int x1 = av_rescale_rnd(r->x + r->w, dst->width, src->width, AV_ROUND_UP) + DIRTY_PAD;
+        int y0 = av_rescale(r->y, dst->height, src->height) - DIRTY_PAD;
+        int y1 = av_rescale_rnd(r->y + r->h, dst->height, src->height, AV_ROUND_UP) + DIRTY_PAD;
+
+        x0 = FFMAX(x0, 0);
+        x1 = FFMIN(x1, dst->width);
+        y0 = FFMAX(y0, 0);
+        y1 = FFMIN(y1, dst->height);
+        r->x = x0;
+        r->y = y0;
+        r->w = x1 - x0;
+        r->h = y1 - y0;
+
+        /* whole rows are scaled, bands may not overlap or go backwards */
+        y0 = FFMAX(y0 - y0 % align, done);
+        y1 = FFMIN(FFALIGN(y1, align), dst->height);
+        if (y1 <= y0)
+            continue;
+
+        ret = sws_receive_slice(is->sws_ctx, y0, y1 - y0);
+        if (ret >= 0 && is->send_image && is->shm.ptr)
         {
-            // 分配一个新的AVFrame，用于存放转换后的软件帧
-            sw_frame = av_frame_alloc();
-            if (!sw_frame)
-            {
-                fprintf(stderr, "Could not allocate frame\n");
-                do_exit(is);
-                return;
-            }
+            socket_send_image_part(&is->shm, y0 * dst->linesize[0],
+                dst->data[0] + y0 * dst->linesize[0], (y1 - y0) * dst->linesize[0]);
+        }
+        done = y1;
+    }
 
-            // 将硬件帧转换为软件帧
-            int ret = av_hwframe_transfer_data(sw_frame, vp->frame, 0);
-            if (ret < 0)
-            {
-                fprintf(stderr, "Error transferring the data to system memory\n");
-                do_exit(is);
-                return;
-            }
+    sws_frame_end(is->sws_ctx);
+    return ret;
+}
+
+/* the rectangle table after the pixels, the sequence is written last */
+static void video_publish_rects(VideoState* is, DirtyRect* rects, int nb_rects)
+{
+    uint8_t header[DIRTY_HEADER_SIZE];
+    int offset = is->img_width * is->img_height * 4;
+    int i;
+
+    if (!nb_rects)
+    {
+        AV_WL16(header + 8, 0);
+        AV_WL16(header + 10, 0);
+        AV_WL16(header + 12, is->img_width);
+        AV_WL16(header + 14, is->img_height);
+        nb_rects = 1;
+    }
+    else
+    {
+        for (i = 0; i < nb_rects; i++)
+        {
+            AV_WL16(header + 8 + i * 8, rects[i].x);
+            AV_WL16(header + 10 + i * 8, rects[i].y);
+            AV_WL16(header + 12 + i * 8, rects[i].w);
+            AV_WL16(header + 14 + i * 8, rects[i].h);
         }
-        else
+    }
+    AV_WL32(header + 4, nb_rects);
+    socket_send_image_part(&is->shm, offset + 4, header + 4, 4 + nb_rects * 8);
+
+    AV_WL32(header, ++is->dirty_seq);
+    socket_send_image_part(&is->shm, offset, header, 4);
+}
+
+/* the first pass of a looping clip keeps its converted pictures */
+static void video_loop_cache_picture(VideoState* is, AVFrame* frame)
+{
+    if (is->loopc.pictures_state == LOOP_CACHE_RECORDING && is->sws_dst && frame->pts != AV_NOPTS_VALUE &&
+        frame->time_base.num)
+        loop_cache_add_picture(&is->loopc, is->sws_dst, frame->pts * av_q2d(frame->time_base));
+}
+
+/* scale one picture into the shared memory, runs on a pool worker */
+static int video_convert_frame(VideoState* is, AVFrame* frame)
+{
+    AVFrame* sw_frame = NULL;
+    DirtyRect rects[DIRTY_MAX_RECTS];
+    int nb_rects = 0;
+    int publish = is->send_image && is->shm.ptr;
+    int ret = 0;
+
+    if (frame->hw_frames_ctx)
+    {
+        // 分配一个新的AVFrame，用于存放转换后的软件帧
+        sw_frame = av_frame_alloc();
+        if (!sw_frame)
+        {
+            fprintf(stderr, "Could not allocate frame\n");
+            return AVERROR(ENOMEM);
+        }
+
+        // 将硬件帧转换为软件帧
+        ret = av_hwframe_transfer_data(sw_frame, frame, 0);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Error transferring the data to system memory\n");
+            av_frame_free(&sw_frame);
+            return ret;
+        }
+    }
+    else
+    {
+        // 如果帧已经是软件帧，直接使用它
+        sw_frame = frame;
+    }
+
+    if (is->dirty_detect)
+    {
+        /* nothing reached the host meanwhile, the next picture has to go out whole */
+        if (!publish || is->dirty_reset)
+        {
+            is->dirty_reset = 0;
+            dirty_reset(&is->dirty);
+        }
+
+        ret = dirty_update(&is->dirty, sw_frame);
+        if (ret < 0)
         {
-            // 如果帧已经是软件帧，直接使用它
-            sw_frame = vp->frame;
+            av_log(NULL, AV_LOG_WARNING, "Session %d cannot track dirty regions of %s, disabled\n",
+                is->id, av_get_pix_fmt_name(sw_frame->format));
+            is->dirty_detect = 0;
         }
+        else if (ret == 0)
+        {
+            /* same picture as last time */
+            video_loop_cache_picture(is, frame);
+            goto end;
+        }
+        else if (ret < is->dirty.cols * is->dirty.rows)
+        {
+            nb_rects = dirty_rects(&is->dirty, rects, DIRTY_MAX_RECTS);
+        }
+        ret = 0;
+    }
+
+    /* a session inside the mosaic draws straight into its tile once the host asked for pictures */
+    if (mosaic_draw(is->id, sw_frame, &is->tile_sws_ctx, is->send_image))
+    {
+        /* the loop cache only replays the session's own picture */
+        if (is->loopc.pictures_state == LOOP_CACHE_RECORDING)
+            loop_cache_drop_pictures(&is->loopc);
+        ret = 0;
+        goto end;
+    }
 
-        if (!sws_ctx)
+    if (is->sws_dst && sw_frame->format == AV_PIX_FMT_BGRA &&
+        sw_frame->width == is->img_width && sw_frame->height == is->img_height)
+    {
+        /* already converted, a picture replayed from the loop cache is only copied */
+        av_image_copy(is->sws_dst->data, is->sws_dst->linesize, (const uint8_t**)sw_frame->data, sw_frame->linesize,
+            AV_PIX_FMT_BGRA, sw_frame->width, sw_frame->height);
+        nb_rects = 0;
+    }
+    else
+    {
+        if (!is->sws_ctx)
         {
-            sws_ctx = sws_getContext(is->viddec.avctx->width, is->viddec.avctx->height,
-                sw_frame->format, img_width, img_height, AV_PIX_FMT_BGRA,
+            is->sws_ctx = sws_getContext(sw_frame->width, sw_frame->height,
+                sw_frame->format, is->img_width, is->img_height, AV_PIX_FMT_BGRA,
                 SWS_FAST_BILINEAR, NULL, NULL, NULL);
 
-            int ret = av_image_alloc(sws_dst_data, sws_dst_linesize, img_width, img_height, AV_PIX_FMT_BGRA, 1);
+            is->sws_dst = av_frame_alloc();
+            ret = AVERROR(ENOMEM);
+            if (is->sws_ctx && is->sws_dst)
+            {
+                is->sws_dst->format = AV_PIX_FMT_BGRA;
+                is->sws_dst->width = is->img_width;
+                is->sws_dst->height = is->img_height;
+                /* packed rows, the shared memory has no padding */
+                ret = av_frame_get_buffer(is->sws_dst, 1);
+            }
             if (ret < 0)
             {
                 printf("Could not allocate destination image\n");
-                do_exit(is);
-                return;
+                sws_freeContext(is->sws_ctx);
+                is->sws_ctx = NULL;
+                av_frame_free(&is->sws_dst);
+                goto end;
             }
 
-            av_log(NULL, AV_LOG_INFO, "Create sws %dx%d -> %dx%d\n",
-                is->viddec.avctx->width, is->viddec.avctx->height,
-                img_width, img_height);
+            av_log(NULL, AV_LOG_INFO, "Session %d create sws %dx%d -> %dx%d\n", is->id,
+                sw_frame->width, sw_frame->height,
+                is->img_width, is->img_height);
+            nb_rects = 0;
+        }
+
+        if (nb_rects)
+        {
+            ret = video_convert_rects(is, sw_frame, rects, nb_rects);
+            if (ret < 0)
+                goto end;
+        }
+        else
+        {
+            sws_scale(is->sws_ctx, (const uint8_t* const*)sw_frame->data, sw_frame->linesize,
+                0, sw_frame->height, is->sws_dst->data, is->sws_dst->linesize);
         }
+        video_loop_cache_picture(is, frame);
+    }
+
+    if (publish && !nb_rects)
+    {
+        socket_send_image(&is->shm, is->sws_dst->data[0], is->img_width * is->img_height * 4);
+    }
+
+    if (publish && is->dirty_header)
+        video_publish_rects(is, rects, nb_rects);
+
+end:
+    if (sw_frame != frame)
+    {
+        av_frame_free(&sw_frame);
+    }
+    return ret;
+}
 
-        sws_scale(sws_ctx, sw_frame->data, sw_frame->linesize,
-            0, sw_frame->height, sws_dst_data, sws_dst_linesize);
+/* keeps converting until no newer picture was handed over meanwhile */
+static void video_convert_task(void* arg)
+{
+    VideoState* is = arg;
+    AVFrame* frame = av_frame_alloc();
+    int ret = frame ? 0 : AVERROR(ENOMEM);
 
-        if (socket_send)
+    for (;;)
+    {
+        SDL_LockMutex(is->convert_mutex);
+        if (!is->convert_pending || ret < 0)
         {
-            socket_send_image(sws_dst_data[0], img_width * img_height * 4);
+            /* once convert_busy is cleared stream_close() may free the session */
+            if (ret < 0)
+                push_quit_event(is);
+            av_frame_unref(is->convert_frame);
+            is->convert_pending = 0;
+            is->convert_busy = 0;
+            SDL_CondSignal(is->convert_cond);
+            SDL_UnlockMutex(is->convert_mutex);
+            break;
         }
+        av_frame_move_ref(frame, is->convert_frame);
+        is->convert_pending = 0;
+        SDL_UnlockMutex(is->convert_mutex);
+
+        ret = video_convert_frame(is, frame);
+        av_frame_unref(frame);
+    }
+
+    av_frame_free(&frame);
+}
+
+static void video_image_display(VideoState* is)
+{
+    Frame* vp;
+    AVFrame* src;
+    int* uploaded;
+    int submit = 0;
+    int ret;
+
+    vp = frame_queue_peek_last(&is->pictq);
+    src = vp->frame;
+    uploaded = &vp->uploaded;
+    /* a picture from the step cache is shown instead of the queue */
+    if (is->step_frame)
+    {
+        src = is->step_frame;
+        uploaded = &is->step_uploaded;
+    }
 
-        vp->uploaded = 1;
-        vp->flip_v = sw_frame->linesize[0] < 0;
+    /* nobody looks at it, keep the clocks running but skip the conversion */
+    if (is->hidden)
+        return;
 
-        if (sw_frame != vp->frame)
+    if (!*uploaded)
+    {
+        /* hand a reference to the pool, a picture not picked up yet is replaced */
+        SDL_LockMutex(is->convert_mutex);
+        av_frame_unref(is->convert_frame);
+        ret = av_frame_ref(is->convert_frame, src);
+        if (ret >= 0)
         {
-            av_frame_free(&sw_frame);
+            is->convert_pending = 1;
+            if (!is->convert_busy)
+                submit = is->convert_busy = 1;
+        }
+        SDL_UnlockMutex(is->convert_mutex);
+
+        if (ret < 0)
+        {
+            push_quit_event(is);
+            return;
+        }
+        if (submit && pool_submit(video_convert_task, is, is->priority) < 0)
+        {
+            SDL_LockMutex(is->convert_mutex);
+            is->convert_busy = 0;
+            SDL_UnlockMutex(is->convert_mutex);
+            push_quit_event(is);
+            return;
         }
+
+        *uploaded = 1;
+        vp->flip_v = vp->frame->linesize[0] < 0;
     }
 }
 
-static void set_default_window_size(int width, int height, AVRational sar)
+static void set_default_window_size(VideoState* is, int width, int height, AVRational sar)
 {
     SDL_Rect rect;
-    int max_width = img_max_width ? img_max_width : INT_MAX;
-    int max_height = img_max_height ? img_max_height : INT_MAX;
+    int max_width = is->img_max_width ? is->img_max_width : INT_MAX;
+    int max_height = is->img_max_height ? is->img_max_height : INT_MAX;
     if (max_width == INT_MAX && max_height == INT_MAX)
         max_height = height;
     calculate_display_rect(&rect, max_width, max_height, width, height, sar);
-    img_width = rect.w;
-    img_height = rect.h;
+    is->img_width = rect.w;
+    is->img_height = rect.h;
 }
 
 static int video_open(VideoState* is)
 {
-    is->width = img_width;
-    is->height = img_height;
+    is->width = is->img_width;
+    is->height = is->img_height;
 
-    av_log(NULL, AV_LOG_INFO, "Set image size to %dx%d\n", img_width, img_height);
+    av_log(NULL, AV_LOG_INFO, "Session %d set image size to %dx%d\n", is->id, is->img_width, is->img_height);
 
-    if (!send && socket_conn)
+    if (!is->size_sent && socket_conn)
     {
-        send = 1;
-        socket_send_image_size(is->mem_name, img_width, img_height);
+        is->size_sent = 1;
+        /* a bad name or size from the host only ends this session */
+        if (socket_send_image_size(is->id, &is->shm, is->mem_name, is->img_width, is->img_height,
+            is->dirty_header ? DIRTY_HEADER_SIZE : 0) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Session %d cannot share its pictures\n", is->id);
+            push_quit_event(is);
+            return -1;
+        }
     }
 
     return 0;
@@ -285,6 +620,71 @@ static void video_display(VideoState* is)
         video_image_display(is);
 }
 
+/* show the cached neighbour of the picture at pts, dir < 0 for the previous one */
+static int step_show_cached(VideoState* is, double pts, int dir)
+{
+    AVFrame* frame = av_frame_alloc();
+    double step_pts;
+
+    if (!frame)
+        return 0;
+    if (gop_cache_step(&is->gop, pts, dir, frame, &step_pts) <= 0)
+    {
+        av_frame_free(&frame);
+        return 0;
+    }
+    av_frame_free(&is->step_frame);
+    is->step_frame = frame;
+    is->step_pts = step_pts;
+    is->step_uploaded = 0;
+    is->force_refresh = 1;
+    return 1;
+}
+
+static void step_to_prev_frame(VideoState* is)
+{
+    double pts = NAN;
+
+    if (is->step_frame)
+        pts = is->step_pts;
+    else if (is->pictq.rindex_shown)
+        pts = frame_queue_peek_last(&is->pictq)->pts;
+    if (isnan(pts) || !is->video_st)
+        return;
+
+    if (!is->paused)
+        toggle_pause(is);
+    is->step = 0;
+    if (step_show_cached(is, pts, -1))
+        return;
+
+    /* not cached: decode the GOP before it again and keep all of it, the read thread steps to it */
+    if (!is->ic || is->realtime)
+        return;
+    is->gop_fill_target = pts;
+    is->gop_fill_req = 1;
+    /* a relative seek of -2 puts seek_max right on the target, so the demuxer lands on the keyframe before it */
+    stream_seek(is, (int64_t)((pts - SEEK_TOLERANCE / 10) * AV_TIME_BASE), -2, 0);
+}
+
+static void step_forward(VideoState* is)
+{
+    double head;
+
+    if (!is->step_frame)
+    {
+        step_to_next_frame(is);
+        return;
+    }
+
+    /* walk the cache forward until it meets the picture the queue stands at */
+    head = is->pictq.rindex_shown ? frame_queue_peek_last(&is->pictq)->pts : NAN;
+    if (step_show_cached(is, is->step_pts, 1) && !(is->step_pts >= head - SEEK_TOLERANCE))
+        return;
+    av_frame_free(&is->step_frame);
+    is->force_refresh = 1;
+}
+
 /* called to display each frame */
 static void video_refresh(void* opaque, double* remaining_time)
 {
@@ -356,11 +756,19 @@ static void video_refresh(void* opaque, double* remaining_time)
 
             frame_queue_next(&is->pictq);
             is->force_refresh = 1;
+            av_frame_free(&is->step_frame);
 
             if (is->step && !is->paused)
                 stream_toggle_pause(is);
         }
     display:
+        /* the GOP of a backward step is decoded, show the frame before the one it started from */
+        if (is->step_back_ready && is->paused)
+        {
+            is->step_back_ready = 0;
+            step_show_cached(is, is->gop_fill_target, -1);
+        }
+
         /* display picture */
         if (is->force_refresh && is->pictq.rindex_shown)
             video_display(is);
@@ -369,13 +777,12 @@ static void video_refresh(void* opaque, double* remaining_time)
     if (show_status)
     {
         AVBPrint buf;
-        static int64_t last_time;
         int64_t cur_time;
         int aqsize, vqsize, sqsize;
         double av_diff;
 
         cur_time = av_gettime_relative();
-        if (!last_time || (cur_time - last_time) >= 30000)
+        if (!is->last_status_time || (cur_time - is->last_status_time) >= 30000)
         {
             aqsize = 0;
             vqsize = 0;
@@ -413,7 +820,7 @@ static void video_refresh(void* opaque, double* remaining_time)
             fflush(stderr);
             av_bprint_finalize(&buf, NULL);
 
-            last_time = cur_time;
+            is->last_status_time = cur_time;
         }
     }
 }
@@ -442,10 +849,11 @@ static int queue_picture(VideoState* is, AVFrame* src_frame, double pts, double
     vp->pos = pos;
     vp->serial = serial;
 
-    set_default_window_size(vp->width, vp->height, vp->sar);
+    set_default_window_size(is, vp->width, vp->height, vp->sar);
 
     av_frame_move_ref(vp->frame, src_frame);
     frame_queue_push(&is->pictq);
+    ffclient_wakeup();
     return 0;
 }
 
@@ -461,7 +869,7 @@ static int get_video_frame(VideoState* is, AVFrame* frame)
         double dpts = NAN;
 
         if (frame->pts != AV_NOPTS_VALUE)
-            dpts = av_q2d(is->video_st->time_base) * frame->pts;
+            dpts = av_q2d(is->viddec.avctx->pkt_timebase) * frame->pts;
 
         frame->sample_aspect_ratio = av_guess_sample_aspect_ratio(is->ic, is->video_st, frame);
 
@@ -550,14 +958,28 @@ static double get_rotation(const int32_t* displaymatrix)
     return theta;
 }
 
+/* atempo takes 0.5 to 2 in every FFmpeg version, slower and faster tempos are chained */
+static void audio_tempo_filters(AVBPrint* bp, double tempo)
+{
+    while (tempo < 0.5 || tempo > 2.0)
+    {
+        double step = tempo < 0.5 ? 0.5 : 2.0;
+
+        av_bprintf(bp, "atempo=%f,", step);
+        tempo /= step;
+    }
+    av_bprintf(bp, "atempo=%f", tempo);
+}
+
 static int configure_audio_filters(VideoState* is, const char* afilters, int force_output_format)
 {
-    static const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE };
+    /* float decoders stay float when the device may take it, the device format is known once it is open */
+    enum AVSampleFormat sample_fmts[3] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_NONE, AV_SAMPLE_FMT_NONE };
     int sample_rates[2] = { 0, -1 };
-    AVFilterContext* filt_asrc = NULL, * filt_asink = NULL;
+    AVFilterContext* filt_asrc = NULL, * filt_asink = NULL, * source;
     char aresample_swr_opts[512] = "";
     const AVDictionaryEntry* e = NULL;
-    AVBPrint bp;
+    AVBPrint bp, filters;
     char asrc_args[256];
     int ret;
 
@@ -567,7 +989,11 @@ static int configure_audio_filters(VideoState* is, const char* afilters, int for
     is->agraph->nb_threads = filter_nbthreads;
 
     av_bprint_init(&bp, 0, AV_BPRINT_SIZE_AUTOMATIC);
+    av_bprint_init(&filters, 0, AV_BPRINT_SIZE_AUTOMATIC);
 
+    /* the session profile first, -swr options given by hand override it */
+    if (*resample_profile_opts(is->resample_profile))
+        av_strlcatf(aresample_swr_opts, sizeof(aresample_swr_opts), "%s:", resample_profile_opts(is->resample_profile));
     while ((e = av_dict_iterate(swr_opts, e)))
         av_strlcatf(aresample_swr_opts, sizeof(aresample_swr_opts), "%s=%s:", e->key, e->value);
     if (strlen(aresample_swr_opts))
@@ -593,6 +1019,13 @@ static int configure_audio_filters(VideoState* is, const char* afilters, int for
     if (ret < 0)
         goto end;
 
+    if (force_output_format)
+        sample_fmts[0] = is->audio_tgt.fmt;
+    else if (is->audio_float)
+    {
+        sample_fmts[0] = AV_SAMPLE_FMT_FLT;
+        sample_fmts[1] = AV_SAMPLE_FMT_S16;
+    }
     if ((ret = av_opt_set_int_list(filt_asink, "sample_fmts", sample_fmts, AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0)
         goto end;
     if ((ret = av_opt_set_int(filt_asink, "all_channel_counts", 1, AV_OPT_SEARCH_CHILDREN)) < 0)
@@ -609,7 +1042,23 @@ static int configure_audio_filters(VideoState* is, const char* afilters, int for
             goto end;
     }
 
-    if ((ret = configure_filtergraph(is->agraph, afilters, filt_asrc, filt_asink)) < 0)
+    /* pitch preserving time stretch after the user filters */
+    is->audio_filter_tempo = is->speed <= AUDIO_SPEED_MAX ? is->speed : 1.0;
+    if (afilters)
+        av_bprintf(&filters, "%s", afilters);
+    if (is->audio_filter_tempo != 1.0)
+    {
+        if (afilters)
+            av_bprintf(&filters, ",");
+        audio_tempo_filters(&filters, is->audio_filter_tempo);
+    }
+
+    /* the other tracks join the main stream before the user filters */
+    source = filt_asrc;
+    if (is->audio_mix.nb_tracks && (ret = audio_mix_configure(&is->audio_mix, is->agraph, filt_asrc, &source)) < 0)
+        goto end;
+
+    if ((ret = configure_filtergraph(is->agraph, filters.len ? filters.str : NULL, source, filt_asink)) < 0)
         goto end;
 
     is->in_audio_filter = filt_asrc;
@@ -619,6 +1068,7 @@ end:
     if (ret < 0)
         avfilter_graph_free(&is->agraph);
     av_bprint_finalize(&bp, NULL);
+    av_bprint_finalize(&filters, NULL);
 
     return ret;
 }
@@ -632,6 +1082,8 @@ static int audio_thread(void* arg)
     int reconfigure;
     int got_frame = 0;
     AVRational tb;
+    /* first input timestamp of the graph, atempo counts its output from there */
+    double tempo_start = NAN;
     int ret = 0;
 
     if (!frame)
@@ -651,7 +1103,9 @@ static int audio_thread(void* arg)
                     frame->format, frame->ch_layout.nb_channels) ||
                 av_channel_layout_compare(&is->audio_filter_src.ch_layout, &frame->ch_layout) ||
                 is->audio_filter_src.freq != frame->sample_rate ||
-                is->auddec.pkt_serial != last_serial;
+                is->auddec.pkt_serial != last_serial ||
+                is->audio_filter_tempo != (is->speed <= AUDIO_SPEED_MAX ? is->speed : 1.0) ||
+                audio_mix_changed(&is->audio_mix);
 
             if (reconfigure)
             {
@@ -672,22 +1126,48 @@ static int audio_thread(void* arg)
 
                 if ((ret = configure_audio_filters(is, afilters, 1)) < 0)
                     goto the_end;
+                tempo_start = NAN;
             }
+            if (isnan(tempo_start) && frame->pts != AV_NOPTS_VALUE)
+                tempo_start = frame->pts * av_q2d(tb);
 
+            audio_mix_update_gains(&is->audio_mix, is->agraph);
             if ((ret = av_buffersrc_add_frame(is->in_audio_filter, frame)) < 0)
                 goto the_end;
+            /* the tracks only go into a graph of the current serial, a stale one is rebuilt soon */
+            if (is->audio_mix.nb_tracks && is->auddec.pkt_serial == is->audioq.serial &&
+                (ret = audio_mix_feed(&is->audio_mix, tempo_start)) < 0)
+                goto the_end;
 
             while ((ret = av_buffersink_get_frame_flags(is->out_audio_filter, frame, 0)) >= 0)
             {
                 FrameData* fd = frame->opaque_ref ? (FrameData*)frame->opaque_ref->data : NULL;
+                double pts = NAN, duration = (double)frame->nb_samples / frame->sample_rate * is->audio_filter_tempo;
+
                 tb = av_buffersink_get_time_base(is->out_audio_filter);
+                /* back from the stretched timeline to stream time */
+                if (frame->pts != AV_NOPTS_VALUE)
+                    pts = isnan(tempo_start) ? frame->pts * av_q2d(tb) :
+                        tempo_start + (frame->pts * av_q2d(tb) - tempo_start) * is->audio_filter_tempo;
+
+                /* samples before an accurate seek target are not played */
+                if (is->seek_audio_serial == is->auddec.pkt_serial && !isnan(pts))
+                {
+                    if (pts + duration <= is->seek_target)
+                    {
+                        av_frame_unref(frame);
+                        continue;
+                    }
+                    is->seek_audio_serial = -1;
+                }
+
                 if (!(af = frame_queue_peek_writable(&is->sampq)))
                     goto the_end;
 
-                af->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+                af->pts = pts;
                 af->pos = fd ? fd->pkt_pos : -1;
                 af->serial = is->auddec.pkt_serial;
-                af->duration = av_q2d((AVRational) { frame->nb_samples, frame->sample_rate });
+                af->duration = duration;
 
                 av_frame_move_ref(af->frame, frame);
                 frame_queue_push(&is->sampq);
@@ -717,6 +1197,26 @@ static int decoder_start(Decoder* d, int (*fn)(void*), const char* thread_name,
     return 0;
 }
 
+/* one pass of pictures from the loop cache, until the end or the next seek */
+static void video_loop_replay(VideoState* is, AVFrame* frame)
+{
+    int serial = is->loop_replay_serial;
+    double pts, duration;
+    int i;
+
+    for (i = 0; is->videoq.serial == serial; i++)
+    {
+        if (!loop_cache_picture(&is->loopc, i, frame, &pts, &duration))
+            break;
+        if (queue_picture(is, frame, pts, duration, -1, serial) < 0)
+            break;
+    }
+    av_frame_unref(frame);
+    if (is->videoq.serial == serial)
+        is->viddec.finished = serial;
+    is->loop_replay_serial = -1;
+}
+
 static int video_thread(void* arg)
 {
     VideoState* is = arg;
@@ -724,7 +1224,7 @@ static int video_thread(void* arg)
     double pts;
     double duration;
     int ret;
-    AVRational tb = is->video_st->time_base;
+    AVRational tb = is->viddec.avctx->pkt_timebase;
     AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, NULL);
 
     int last_w = 0;
@@ -737,6 +1237,13 @@ static int video_thread(void* arg)
 
     for (;;)
     {
+        /* pictures from the loop cache are converted already, they are queued without decoding */
+        if (is->loop_replay_serial >= 0 && is->loop_replay_serial == is->videoq.serial)
+        {
+            video_loop_replay(is, frame);
+            continue;
+        }
+
         ret = get_video_frame(is, frame);
         if (ret < 0)
             goto the_end;
@@ -769,9 +1276,71 @@ static int video_thread(void* arg)
         is->frame_last_filter_delay = av_gettime_relative() / 1000000.0 - is->frame_last_returned_time;
         if (fabs(is->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0)
             is->frame_last_filter_delay = 0;
-        tb = is->video_st->time_base;
+        tb = is->viddec.avctx->pkt_timebase;
+        /* the pool reads it from the frame, the stream may be closed by then */
+        frame->time_base = tb;
         duration = (frame_rate.num && frame_rate.den ? av_q2d((AVRational) { frame_rate.den, frame_rate.num }) : 0);
         pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+
+        /* stepping back: the GOP decoded again goes into the cache, the target is queued as usual */
+        if (is->gop_fill_serial == is->viddec.pkt_serial && !isnan(pts))
+        {
+            gop_cache_add(&is->gop, frame, pts, duration);
+            if (pts + duration / 2 < is->gop_fill_target)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            is->gop_fill_serial = -1;
+            is->step_back_ready = 1;
+        }
+        else if (!frame->hw_frames_ctx || is->paused)
+        {
+            /* hardware pictures are only copied back while stepping */
+            gop_cache_add(&is->gop, frame, pts, duration);
+        }
+
+        /* accurate seek: frames before the target are decoded and dropped, never converted or published */
+        if (is->seek_video_serial == is->viddec.pkt_serial && !isnan(pts))
+        {
+            if (duration > 0 ? pts + duration * (1.0 - SEEK_TOLERANCE) <= is->seek_target : pts < is->seek_target)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            is->seek_video_serial = -1;
+            is->viddec.preroll_serial = -1;
+        }
+
+        /* when decoding falls behind, skip the loop filter, then non-reference frames, then non-keyframes */
+        {
+            int64_t drops = is->frame_drops_early + is->frame_drops_late;
+
+            if (skip_controller_update(&is->skip, is->viddec.busy_time, pts, duration, is->speed,
+                    is->viddec.pkt_serial, drops != is->skip_last_drops))
+                update_video_discard(is);
+            is->skip_last_drops = drops;
+        }
+
+        /* frames above the output rate cap are dropped before the queue, so they are never converted */
+        if (is->max_fps > 0 && !isnan(pts))
+        {
+            double interval = 1.0 / is->max_fps;
+
+            if (is->fps_serial == is->viddec.pkt_serial && pts < is->fps_next_pts - duration / 2)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            /* keep a steady cadence, restart from this frame after a jump */
+            if (is->fps_serial == is->viddec.pkt_serial && pts - is->fps_next_pts < interval)
+                is->fps_next_pts += interval;
+            else
+                is->fps_next_pts = pts + interval;
+            is->fps_serial = is->viddec.pkt_serial;
+            duration = FFMAX(duration, interval);
+        }
+
         ret = queue_picture(is, frame, pts, duration, fd ? fd->pkt_pos : -1, is->viddec.pkt_serial);
         av_frame_unref(frame);
         //if (is->videoq.serial != is->viddec.pkt_serial)
@@ -876,7 +1445,7 @@ static int audio_decode_frame(VideoState* is)
             &is->audio_tgt.ch_layout, is->audio_tgt.fmt, is->audio_tgt.freq,
             &af->frame->ch_layout, af->frame->format, af->frame->sample_rate,
             0, NULL);
-        if (!is->swr_ctx || swr_init(is->swr_ctx) < 0)
+        if (!is->swr_ctx || resample_profile_apply(is->swr_ctx, is->resample_profile) < 0 || swr_init(is->swr_ctx) < 0)
         {
             av_log(NULL, AV_LOG_ERROR,
                 "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
@@ -939,7 +1508,7 @@ static int audio_decode_frame(VideoState* is)
     audio_clock0 = is->audio_clock;
     /* update the audio clock with the pts */
     if (!isnan(af->pts))
-        is->audio_clock = af->pts + (double)af->frame->nb_samples / af->frame->sample_rate;
+        is->audio_clock = af->pts + af->duration;
     else
         is->audio_clock = NAN;
     is->audio_clock_serial = af->serial;
@@ -955,60 +1524,141 @@ static int audio_decode_frame(VideoState* is)
     return resampled_data_size;
 }
 
-/* prepare a new audio buffer */
-static void sdl_audio_callback(void* opaque, Uint8* stream, int len)
+static void audio_meter_report(void* opaque, const uint8_t* data, int size)
 {
     VideoState* is = opaque;
-    int audio_size, len1;
 
-    audio_callback_time = av_gettime_relative();
+    socket_send_audio_level(is->id, data, size);
+}
+
+/*
+ * converts ahead into the PCM ring, so the audio callback never waits for
+ * the decoder and never runs the resampler
+ */
+static int audio_ring_thread(void* arg)
+{
+    VideoState* is = arg;
+    PcmRing* ring = &is->audio_ring;
+    /* a full ring drains by a quarter before more is converted */
+    int quarter = ring->size / 4;
 
-    while (len > 0)
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    while (!is->audio_ring_abort)
     {
+        int n;
+
         if (is->audio_buf_index >= is->audio_buf_size)
         {
-            audio_size = audio_decode_frame(is);
+            int audio_size = audio_decode_frame(is);
+
             if (audio_size < 0)
             {
-                /* if error, just output silence */
-                is->audio_buf = NULL;
-                is->audio_buf_size = SDL_AUDIO_MIN_BUFFER_SIZE / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
-            }
-            else
-            {
-                is->audio_buf_size = audio_size;
+                is->audio_buf_size = is->audio_buf_index = 0;
+                /* paused or closing: sleep until resumed or closed, a bad frame is only skipped */
+                if (is->paused || is->audio_ring_abort || is->audioq.abort_request)
+                    pcm_ring_wait(ring, INT_MAX);
+                continue;
             }
+            /* levels before the volume, a muted tile still shows its meters */
+            if (is->meter.interval)
+                meter_feed(&is->meter, is->audio_buf, audio_size / is->audio_tgt.frame_size, is->audio_tgt.fmt);
+            while (pcm_ring_mark(ring, audio_size, is->audio_clock, is->audio_clock_serial) < 0 && !is->audio_ring_abort)
+                pcm_ring_wait(ring, 0);
+            is->audio_buf_size = audio_size;
             is->audio_buf_index = 0;
         }
-        len1 = is->audio_buf_size - is->audio_buf_index;
-        if (len1 > len)
-            len1 = len;
-        if (!is->muted && is->audio_buf && is->audio_volume == SDL_MIX_MAXVOLUME)
-            memcpy(stream, (uint8_t*)is->audio_buf + is->audio_buf_index, len1);
-        else
-        {
-            memset(stream, 0, len1);
-            if (!is->muted && is->audio_buf)
-            {
-                SDL_MixAudioFormat(stream, (uint8_t*)is->audio_buf + is->audio_buf_index, AUDIO_S16SYS, len1, is->audio_volume);
-            }
-        }
-        len -= len1;
-        stream += len1;
-        is->audio_buf_index += len1;
-    }
-    is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
-    /* Let's assume the audio driver that is used by SDL has two periods. */
-    if (!isnan(is->audio_clock))
-    {
-        set_clock_at(&is->audclk, is->audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec, is->audio_clock_serial, audio_callback_time / 1000000.0);
-        sync_clock_to_slave(&is->extclk, &is->audclk);
+
+        n = pcm_ring_write(ring, is->audio_buf + is->audio_buf_index, is->audio_buf_size - is->audio_buf_index);
+        is->audio_buf_index += n;
+        if (is->audio_buf_index < is->audio_buf_size && !is->audio_ring_abort)
+            pcm_ring_wait(ring, quarter);
     }
+    return 0;
 }
 
-static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int wanted_sample_rate, struct AudioParams* audio_hw_params)
+/* only copies from the ring and applies the volume, nothing in here blocks */
+static void sdl_audio_callback(void* opaque, Uint8* stream, int len)
 {
-    SDL_AudioSpec wanted_spec, spec;
+    VideoState* is = opaque;
+    PcmRing* ring = &is->audio_ring;
+    double pts, latency, time;
+    /* stream seconds per second played */
+    double tempo = is->audio_filter_tempo;
+    int serial, n;
+
+    is->audio_callback_time = av_gettime_relative();
+    time = is->audio_callback_time / 1000000.0;
+
+    pcm_ring_drop_stale(ring, is->audioq.serial);
+    /* whole sample frames only, an underrun must not shift the channels */
+    n = is->paused ? 0 : FFMIN(pcm_ring_fill(ring), len);
+    n -= n % is->audio_tgt.frame_size;
+    memset(stream + n, 0, len - n);
+
+    while (n > 0)
+    {
+        uint8_t* data;
+        int len1 = pcm_ring_peek(ring, &data, n);
+
+        /* straight from the ring into the device buffer, with the volume ramp */
+        gain_apply(&is->audio_gain, stream, data, len1 / av_get_bytes_per_sample(is->audio_tgt.fmt),
+            is->audio_tgt.ch_layout.nb_channels, is->audio_tgt.fmt,
+            is->muted ? 0.0f : (float)is->audio_volume / SDL_MIX_MAXVOLUME);
+        pcm_ring_consume(ring, len1);
+        n -= len1;
+        stream += len1;
+    }
+    /* the host reports what it still has to play, this block comes after it */
+    if (is->audio_shm_name)
+        latency = (double)audio_shm_queued(&is->audio_shm) / is->audio_tgt.freq + (double)len / is->audio_tgt.bytes_per_sec;
+    else
+        latency = latency_update(&is->audio_latency, time, len, &time);
+    /* what happens after the device, e.g. bluetooth, the host knows it */
+    latency += is->audio_latency_offset / 1000.0;
+    if (pcm_ring_clock(ring, is->audio_tgt.bytes_per_sec / tempo, &pts, &serial) && !isnan(pts))
+    {
+        set_clock_at(&is->audclk, pts - latency * tempo, serial, time);
+        sync_clock_to_slave(&is->extclk, &is->audclk);
+    }
+}
+
+/* the host mixes the samples, they go into shared memory in the format that was asked for */
+static int audio_open_shm(VideoState* is, const SDL_AudioSpec* wanted_spec, SDL_AudioSpec* spec)
+{
+    int ret;
+
+    *spec = *wanted_spec;
+    spec->size = spec->samples * spec->channels * (SDL_AUDIO_BITSIZE(spec->format) / 8);
+    if ((ret = audio_shm_open(&is->audio_shm, is->id, is->audio_shm_name, sdl_audio_callback, is,
+        spec->freq, spec->channels, spec->format == AUDIO_F32SYS ? AUDIO_SHM_FLT : AUDIO_SHM_S16, spec->samples)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot export audio to %s: %s\n", is->audio_shm_name, av_err2str(ret));
+        return ret;
+    }
+    av_log(NULL, AV_LOG_INFO, "Audio exported to %s (%d channels, %d Hz)\n",
+        is->audio_shm_name, spec->channels, spec->freq);
+    return 0;
+}
+
+/* no sound card, the null sink plays what the device was asked for */
+static int audio_open_null(VideoState* is, const SDL_AudioSpec* wanted_spec, SDL_AudioSpec* spec)
+{
+    int ret;
+
+    *spec = *wanted_spec;
+    spec->size = spec->samples * spec->channels * (SDL_AUDIO_BITSIZE(spec->format) / 8);
+    if ((ret = null_sink_open(&is->audio_sink, sdl_audio_callback, is,
+        spec->freq * spec->channels * (SDL_AUDIO_BITSIZE(spec->format) / 8), spec->size, is->audio_dump)) < 0)
+        return ret;
+    av_log(NULL, AV_LOG_INFO, "Audio goes to the null sink (%d channels, %d Hz)%s%s\n",
+        spec->channels, spec->freq, is->audio_dump ? ", dump to " : "", is->audio_dump ? is->audio_dump : "");
+    return 0;
+}
+
+static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int wanted_sample_rate, struct AudioParams* audio_hw_params)
+{
+    VideoState* is = opaque;
+    SDL_AudioSpec wanted_spec, spec;
     const char* env;
     static const int next_nb_channels[] = { 0, 0, 1, 6, 2, 6, 4, 6 };
     static const int next_sample_rates[] = { 0, 44100, 48000, 96000, 192000 };
@@ -1037,12 +1687,14 @@ static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int
     }
     while (next_sample_rate_idx && next_sample_rates[next_sample_rate_idx] >= wanted_spec.freq)
         next_sample_rate_idx--;
-    wanted_spec.format = AUDIO_S16SYS;
+    /* float end to end when the device takes it natively, otherwise S16 as before */
+    wanted_spec.format = is->audio_float ? AUDIO_F32SYS : AUDIO_S16SYS;
     wanted_spec.silence = 0;
     wanted_spec.samples = FFMAX(SDL_AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / SDL_AUDIO_MAX_CALLBACKS_PER_SEC));
     wanted_spec.callback = sdl_audio_callback;
     wanted_spec.userdata = opaque;
-    while (!(audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE)))
+    while (!is->audio_null && !is->audio_shm_name && !(is->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE |
+        (wanted_spec.format == AUDIO_F32SYS ? SDL_AUDIO_ALLOW_FORMAT_CHANGE : 0))))
     {
         av_log(NULL, AV_LOG_WARNING, "SDL_OpenAudio (%d channels, %d Hz): %s\n",
             wanted_spec.channels, wanted_spec.freq, SDL_GetError());
@@ -1053,18 +1705,36 @@ static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int
             wanted_spec.channels = wanted_nb_channels;
             if (!wanted_spec.freq)
             {
-                av_log(NULL, AV_LOG_ERROR,
-                    "No more combinations to try, audio open failed\n");
-                return -1;
+                /* keep audio as the master clock instead of dropping it */
+                av_log(NULL, AV_LOG_WARNING,
+                    "No more combinations to try, falling back to the null sink\n");
+                wanted_spec.freq = wanted_sample_rate;
+                wanted_spec.channels = wanted_nb_channels;
+                is->audio_null = 1;
             }
         }
         av_channel_layout_default(wanted_channel_layout, wanted_spec.channels);
     }
-    if (spec.format != AUDIO_S16SYS)
+    if (is->audio_shm_name)
     {
-        av_log(NULL, AV_LOG_ERROR,
-            "SDL advised audio format %d is not supported!\n", spec.format);
+        if (audio_open_shm(is, &wanted_spec, &spec) < 0)
+            return -1;
+    }
+    else if (is->audio_null && audio_open_null(is, &wanted_spec, &spec) < 0)
         return -1;
+    if (spec.format != AUDIO_S16SYS && spec.format != AUDIO_F32SYS)
+    {
+        /* some other native format, let SDL convert from S16 */
+        SDL_CloseAudioDevice(is->audio_dev);
+        wanted_spec.format = AUDIO_S16SYS;
+        wanted_spec.channels = spec.channels;
+        wanted_spec.freq = spec.freq;
+        if (!(is->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, 0)))
+        {
+            av_log(NULL, AV_LOG_ERROR,
+                "SDL advised audio format %d is not supported!\n", spec.format);
+            return -1;
+        }
     }
     if (spec.channels != wanted_spec.channels)
     {
@@ -1078,7 +1748,7 @@ static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int
         }
     }
 
-    audio_hw_params->fmt = AV_SAMPLE_FMT_S16;
+    audio_hw_params->fmt = spec.format == AUDIO_F32SYS ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
     audio_hw_params->freq = spec.freq;
     if (av_channel_layout_copy(&audio_hw_params->ch_layout, wanted_channel_layout) < 0)
         return -1;
@@ -1092,26 +1762,28 @@ static int audio_open(void* opaque, AVChannelLayout* wanted_channel_layout, int
     return spec.size;
 }
 
-static int hw_decoder_init(AVCodecContext* ctx, const enum AVHWDeviceType type)
+static int hw_decoder_init(VideoState* is, AVCodecContext* ctx, const enum AVHWDeviceType type)
 {
     int err = 0;
 
-    if ((err = av_hwdevice_ctx_create(&hw_device_ctx, type,
+    av_buffer_unref(&is->hw_device_ctx);
+    if ((err = av_hwdevice_ctx_create(&is->hw_device_ctx, type,
         NULL, NULL, 0)) < 0) {
         fprintf(stderr, "Failed to create specified HW device.\n");
         return err;
     }
-    ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+    ctx->hw_device_ctx = av_buffer_ref(is->hw_device_ctx);
 
     return err;
 }
 
 static enum AVPixelFormat get_hw_format(AVCodecContext* ctx, const enum AVPixelFormat* pix_fmts)
 {
+    VideoState* is = ctx->opaque;
     const enum AVPixelFormat* p;
 
     for (p = pix_fmts; *p != -1; p++) {
-        if (*p == hw_pix_fmt)
+        if (*p == is->hw_pix_fmt)
             return *p;
     }
 
@@ -1119,7 +1791,7 @@ static enum AVPixelFormat get_hw_format(AVCodecContext* ctx, const enum AVPixelF
     return AV_PIX_FMT_NONE;
 }
 
-static int test_hw_device(AVCodecContext* avctx, AVCodec* codec, enum AVHWDeviceType type)
+static int test_hw_device(VideoState* is, AVCodecContext* avctx, const AVCodec* codec, enum AVHWDeviceType type)
 {
     av_log(NULL, AV_LOG_INFO, "Test hardware device type: %s\n", av_hwdevice_get_type_name(type));
 
@@ -1132,11 +1804,12 @@ static int test_hw_device(AVCodecContext* avctx, AVCodec* codec, enum AVHWDevice
         }
         if (config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX &&
             config->device_type == type) {
-            hw_pix_fmt = config->pix_fmt;
+            is->hw_pix_fmt = config->pix_fmt;
 
+            avctx->opaque = is;
             avctx->get_format = get_hw_format;
 
-            if (hw_decoder_init(avctx, type) < 0)
+            if (hw_decoder_init(is, avctx, type) < 0)
             {
                 break;
             }
@@ -1271,8 +1944,9 @@ static int stream_component_open(VideoState* is, int stream_index)
     if (fast)
         avctx->flags2 |= AV_CODEC_FLAG2_FAST;
 
+    /* share the core budget between the sessions instead of one thread per core each */
     if (!av_dict_get(opts, "threads", NULL, 0))
-        av_dict_set(&opts, "threads", "auto", 0);
+        av_dict_set_int(&opts, "threads", FFMAX(1, pool_budget() / FFMAX(1, nb_sessions)), 0);
     if (stream_lowres)
         av_dict_set_int(&opts, "lowres", stream_lowres, 0);
 
@@ -1283,11 +1957,12 @@ static int stream_component_open(VideoState* is, int stream_index)
 #ifdef __linux__
         if (rktype != 0)
         {
-            hw_pix_fmt = AV_PIX_FMT_NV12;
+            is->hw_pix_fmt = AV_PIX_FMT_NV12;
 
+            avctx->opaque = is;
             avctx->get_format = get_hw_format;
 
-            if (hw_decoder_init(avctx, rktype) < 0)
+            if (hw_decoder_init(is, avctx, rktype) < 0)
             {
                 goto fail;
             }
@@ -1303,7 +1978,7 @@ static int stream_component_open(VideoState* is, int stream_index)
             type = av_hwdevice_find_type_by_name(is->hw_name);
             if (type != AV_HWDEVICE_TYPE_NONE)
             {
-                if (!test_hw_device(avctx, codec, type))
+                if (!test_hw_device(is, avctx, codec, type))
                 {
                     goto fail;
                 }
@@ -1320,7 +1995,7 @@ static int stream_component_open(VideoState* is, int stream_index)
         
         while ((type = av_hwdevice_iterate_types(type)) != AV_HWDEVICE_TYPE_NONE)
         {
-            if (test_hw_device(avctx, codec, type))
+            if (test_hw_device(is, avctx, codec, type))
             {
                 break;
             }
@@ -1346,6 +2021,9 @@ done:
             {
                 AVFilterContext* sink;
 
+                if (is->audio_mix.all || is->audio_mix.nb_streams)
+                    audio_mix_open(&is->audio_mix, ic, stream_index, audio_codec_name,
+                        FFMAX(1, pool_budget() / FFMAX(1, nb_sessions)), is->continue_read_thread);
                 is->audio_filter_src.freq = avctx->sample_rate;
                 ret = av_channel_layout_copy(&is->audio_filter_src.ch_layout, &avctx->ch_layout);
                 if (ret < 0)
@@ -1368,6 +2046,14 @@ done:
             is->audio_src = is->audio_tgt;
             is->audio_buf_size = 0;
             is->audio_buf_index = 0;
+            latency_init(&is->audio_latency, is->audio_tgt.bytes_per_sec);
+            gain_init(&is->audio_gain, is->audio_tgt.freq, is->muted ? 0.0f : (float)is->audio_volume / SDL_MIX_MAXVOLUME);
+            if (is->meter_rate && meter_init(&is->meter, is->audio_tgt.freq, is->audio_tgt.ch_layout.nb_channels,
+                is->meter_rate, is->meter_bands, audio_meter_report, is) < 0)
+                av_log(NULL, AV_LOG_WARNING, "Audio meters are not available\n");
+            if ((ret = pcm_ring_init(&is->audio_ring, FFMAX((int)((int64_t)is->audio_ring_ms * is->audio_tgt.bytes_per_sec / 1000),
+                4 * is->audio_hw_buf_size))) < 0)
+                goto fail;
 
             /* init averaging filter */
             is->audio_diff_avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
@@ -1388,7 +2074,20 @@ done:
             }
             if ((ret = decoder_start(&is->auddec, audio_thread, "audio_decoder", is)) < 0)
                 goto out;
-            SDL_PauseAudioDevice(audio_dev, 0);
+            is->audio_ring_abort = 0;
+            is->audio_ring_tid = SDL_CreateThread(audio_ring_thread, "audio_ring", is);
+            if (!is->audio_ring_tid)
+            {
+                av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+                ret = AVERROR(ENOMEM);
+                goto out;
+            }
+            if (is->audio_dev)
+                SDL_PauseAudioDevice(is->audio_dev, 0);
+            else if (is->audio_shm_name)
+                audio_shm_pause(&is->audio_shm, 0);
+            else
+                null_sink_pause(&is->audio_sink, 0);
 
         break;
     case AVMEDIA_TYPE_VIDEO:
@@ -1397,6 +2096,8 @@ done:
 
         if ((ret = decoder_init(&is->viddec, avctx, &is->videoq, is->continue_read_thread)) < 0)
             goto fail;
+        is->viddec.priority = is->priority;
+        update_video_discard(is);
         if ((ret = decoder_start(&is->viddec, video_thread, "video_decoder", is)) < 0)
             goto out;
         is->queue_attachments_req = 1;
@@ -1408,6 +2109,8 @@ done:
     goto out;
 
 fail:
+    if (avctx->codec_type == AVMEDIA_TYPE_AUDIO)
+        audio_mix_close(&is->audio_mix, ic);
     avcodec_free_context(&avctx);
 out:
     av_channel_layout_uninit(&ch_layout);
@@ -1462,75 +2165,67 @@ fail:
     return ret;
 }
 
-/* this thread gets the stream from the disk or the network */
-static int read_thread(void* arg)
+/* speed and scan mode follow the streams that are open, so this runs again after every open */
+static void update_speed(VideoState* is)
 {
-    VideoState* is = arg;
-    AVFormatContext* ic = NULL;
-    int err, i, ret;
-    int st_index[AVMEDIA_TYPE_NB];
-    AVPacket* pkt = NULL;
-    int64_t stream_start_time;
-    int pkt_in_play_range = 0;
-    const AVDictionaryEntry* t;
-    SDL_mutex* wait_mutex = SDL_CreateMutex();
-    int scan_all_pmts_set = 0;
-    int64_t pkt_ts;
+    int scan;
 
-    if (!wait_mutex)
+    if (is->realtime && is->speed != 1.0)
     {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
-        ret = AVERROR(ENOMEM);
-        goto fail;
+        av_log(NULL, AV_LOG_WARNING, "Session %d is live, playing at normal speed\n", is->id);
+        is->speed = 1.0;
     }
+    scan = is->speed >= SCAN_SPEED_MIN && is->video_st &&
+        !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC);
+    if (scan && !is->scan)
+        is->scan_index = 1;
+    is->scan = scan;
+    set_clock_speed(&is->extclk, is->speed);
+    set_clock_speed(&is->audclk, is->speed <= AUDIO_SPEED_MAX ? is->speed : 1.0);
+    update_video_discard(is);
+}
 
-    memset(st_index, -1, sizeof(st_index));
-    is->eof = 0;
+/* open and probe one input, also runs on the playlist thread for the next item */
+static int stream_open_format(VideoState* is, const char* url, AVFormatContext** pic)
+{
+    AVFormatContext* ic = NULL;
+    int err, i, ret;
+    const AVDictionaryEntry* t;
+    AVDictionary* input_opts = NULL;
 
-    pkt = av_packet_alloc();
-    if (!pkt)
-    {
-        av_log(NULL, AV_LOG_FATAL, "Could not allocate packet.\n");
-        ret = AVERROR(ENOMEM);
-        goto fail;
-    }
     ic = avformat_alloc_context();
     if (!ic)
     {
         av_log(NULL, AV_LOG_FATAL, "Could not allocate context.\n");
-        ret = AVERROR(ENOMEM);
-        goto fail;
+        return AVERROR(ENOMEM);
     }
     ic->interrupt_callback.callback = decode_interrupt_cb;
     ic->interrupt_callback.opaque = is;
-    if (!av_dict_get(format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE))
-    {
-        av_dict_set(&format_opts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
-        scan_all_pmts_set = 1;
-    }
+
+    /* sessions open concurrently, so work on a private copy of the options */
+    av_dict_copy(&input_opts, format_opts, 0);
+    av_dict_set(&input_opts, "scan_all_pmts", "1", AV_DICT_DONT_OVERWRITE);
 
     if (is->nobuffer)
     {
-        av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+        av_dict_set(&input_opts, "fflags", "nobuffer", 0);
     }
 
-    err = avformat_open_input(&ic, is->filename, is->iformat, &format_opts);
+    err = avformat_open_input(&ic, url, is->iformat, &input_opts);
     if (err < 0)
     {
-        print_error(is->filename, err);
+        print_error(url, err);
         ret = -1;
         goto fail;
     }
-    if (scan_all_pmts_set)
-        av_dict_set(&format_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE);
+    av_dict_set(&input_opts, "scan_all_pmts", NULL, AV_DICT_MATCH_CASE);
 
-    if ((t = av_dict_get(format_opts, "", NULL, AV_DICT_IGNORE_SUFFIX)))
+    if ((t = av_dict_get(input_opts, "", NULL, AV_DICT_IGNORE_SUFFIX)))
     {
         av_log(NULL, AV_LOG_ERROR, "Option %s not found.\n", t->key);
         ret = AVERROR_OPTION_NOT_FOUND;
         goto fail;
     }
-    is->ic = ic;
 
     if (genpts)
         ic->flags |= AVFMT_FLAG_GENPTS;
@@ -1558,7 +2253,7 @@ static int read_thread(void* arg)
         if (err < 0)
         {
             av_log(NULL, AV_LOG_WARNING,
-                "%s: could not find codec parameters\n", is->filename);
+                "%s: could not find codec parameters\n", url);
             ret = -1;
             goto fail;
         }
@@ -1567,34 +2262,22 @@ static int read_thread(void* arg)
     if (ic->pb)
         ic->pb->eof_reached = 0; // FIXME hack, ffplay maybe should not use avio_feof() to test for the end
 
-    if (seek_by_bytes < 0)
-        seek_by_bytes = !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
-        !!(ic->iformat->flags & AVFMT_TS_DISCONT) &&
-        strcmp("ogg", ic->iformat->name);
-
-    is->max_frame_duration = (ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
-
-    /* if seeking requested, we execute it */
-    if (start_time != AV_NOPTS_VALUE)
-    {
-        int64_t timestamp;
-
-        timestamp = start_time;
-        /* add the stream start time */
-        if (ic->start_time != AV_NOPTS_VALUE)
-            timestamp += ic->start_time;
-        ret = avformat_seek_file(ic, -1, INT64_MIN, timestamp, INT64_MAX, 0);
-        if (ret < 0)
-        {
-            av_log(NULL, AV_LOG_WARNING, "%s: could not seek to position %0.3f\n",
-                is->filename, (double)timestamp / AV_TIME_BASE);
-        }
-    }
+    *pic = ic;
+    ic = NULL;
+    ret = 0;
+fail:
+    avformat_close_input(&ic);
+    av_dict_free(&input_opts);
+    return ret;
+}
 
-    is->realtime = is_realtime(ic);
+/* the streams to play, the demuxer drops all others */
+static void stream_find_streams(VideoState* is, AVFormatContext* ic, int* st_index)
+{
+    int i;
 
-    if (show_status)
-        av_dump_format(ic, 0, is->filename, 0);
+    for (i = 0; i < AVMEDIA_TYPE_NB; i++)
+        st_index[i] = -1;
 
     for (i = 0; i < ic->nb_streams; i++)
     {
@@ -1624,6 +2307,64 @@ static int read_thread(void* arg)
                 st_index[AVMEDIA_TYPE_AUDIO],
                 st_index[AVMEDIA_TYPE_VIDEO],
                 NULL, 0);
+    else
+        st_index[AVMEDIA_TYPE_AUDIO] = -1;
+}
+
+/* open the input and pick its streams, the session is not touched yet */
+static int stream_probe_input(VideoState* is, AVFormatContext** pic, int* st_index)
+{
+    AVFormatContext* ic = NULL;
+    int ret;
+
+    ret = stream_open_format(is, is->filename, &ic);
+    if (ret < 0)
+        return ret;
+
+    /* if seeking requested, we execute it */
+    if (start_time != AV_NOPTS_VALUE)
+    {
+        int64_t timestamp;
+
+        timestamp = start_time;
+        /* add the stream start time */
+        if (ic->start_time != AV_NOPTS_VALUE)
+            timestamp += ic->start_time;
+        ret = avformat_seek_file(ic, -1, INT64_MIN, timestamp, INT64_MAX, 0);
+        if (ret < 0)
+        {
+            av_log(NULL, AV_LOG_WARNING, "%s: could not seek to position %0.3f\n",
+                is->filename, (double)timestamp / AV_TIME_BASE);
+        }
+    }
+
+    if (show_status)
+        av_dump_format(ic, 0, is->filename, 0);
+
+    stream_find_streams(is, ic, st_index);
+    *pic = ic;
+    return 0;
+}
+
+/* open the input and its streams */
+static int stream_open_input(VideoState* is)
+{
+    AVFormatContext* ic = NULL;
+    int ret;
+    int st_index[AVMEDIA_TYPE_NB];
+
+    ret = stream_probe_input(is, &ic, st_index);
+    if (ret < 0)
+        return ret;
+    is->ic = ic;
+
+    if (is->seek_by_bytes < 0)
+        is->seek_by_bytes = !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+        !!(ic->iformat->flags & AVFMT_TS_DISCONT) &&
+        strcmp("ogg", ic->iformat->name);
+
+    is->max_frame_duration = (ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
+    is->realtime = is_realtime(ic);
 
     is->show_mode = show_mode;
     if (st_index[AVMEDIA_TYPE_VIDEO] >= 0)
@@ -1632,7 +2373,7 @@ static int read_thread(void* arg)
         AVCodecParameters* codecpar = st->codecpar;
         AVRational sar = av_guess_sample_aspect_ratio(ic, st, NULL);
         if (codecpar->width)
-            set_default_window_size(codecpar->width, codecpar->height, sar);
+            set_default_window_size(is, codecpar->width, codecpar->height, sar);
     }
 
     /* open the streams */
@@ -1653,342 +2394,1571 @@ static int read_thread(void* arg)
     {
         av_log(NULL, AV_LOG_FATAL, "Failed to open file '%s' or configure filtergraph\n",
             is->filename);
-        ret = -1;
-        goto fail;
+        is->ic = NULL;
+        avformat_close_input(&ic);
+        return -1;
+    }
+    update_speed(is);
+    return 0;
+}
+
+/*
+ * ic and the decoders are only replaced on the main thread, which reads them
+ * everywhere without a lock. The read thread hands over the new input and waits.
+ * Takes ic in any case; on failure the new input is in place without decoders.
+ */
+static int stream_switch_input(VideoState* is, AVFormatContext** pic, const int* st_index)
+{
+    SDL_Event event;
+    int ret;
+
+    SDL_LockMutex(is->continue_read_mutex);
+    is->switch_ic = *pic;
+    *pic = NULL;
+    memcpy(is->switch_stream, st_index, sizeof(is->switch_stream));
+    is->switch_state = 1;
+    SDL_UnlockMutex(is->continue_read_mutex);
+
+    event.type = FF_SWITCH_EVENT;
+    event.user.code = is->id;
+    event.user.data1 = is;
+    ret = SDL_PushEvent(&event) > 0 ? 0 : AVERROR(ENOMEM);
+    if (!ret)
+        ffclient_wakeup();
+
+    SDL_LockMutex(is->continue_read_mutex);
+    while (!ret && (is->switch_state == 2 || (is->switch_state == 1 && !is->abort_request)))
+        SDL_CondWait(is->continue_read_thread, is->continue_read_mutex);
+    if (is->switch_state == 1)
+    {
+        /* closing, or the event was lost: the main thread never started */
+        is->switch_state = 0;
+        avformat_close_input(&is->switch_ic);
+        ret = ret < 0 ? ret : AVERROR_EXIT;
     }
+    else if (!ret)
+    {
+        ret = is->switch_ret;
+    }
+    SDL_UnlockMutex(is->continue_read_mutex);
+    return ret;
+}
 
-    if (infinite_buffer < 0 && is->realtime)
-        infinite_buffer = 1;
+/* main thread, the other half of stream_switch_input() */
+static void stream_switch_run(VideoState* is)
+{
+    int ret = 0;
 
-    for (;;)
+    SDL_LockMutex(is->continue_read_mutex);
+    if (is->switch_state != 1)
+    {
+        SDL_UnlockMutex(is->continue_read_mutex);
+        return;
+    }
+    is->switch_state = 2;
+    SDL_UnlockMutex(is->continue_read_mutex);
+
+    if (is->audio_stream >= 0)
+        stream_component_close(is, is->audio_stream);
+    if (is->video_stream >= 0)
+        stream_component_close(is, is->video_stream);
+    avformat_close_input(&is->ic);
+    is->ic = is->switch_ic;
+    is->switch_ic = NULL;
+    is->item_extradata = 0;
+
+    if (is->switch_stream[AVMEDIA_TYPE_AUDIO] >= 0 && stream_component_open(is, is->switch_stream[AVMEDIA_TYPE_AUDIO]) < 0)
+        av_log(NULL, AV_LOG_ERROR, "Session %d cannot open audio stream %d of %s\n",
+            is->id, is->switch_stream[AVMEDIA_TYPE_AUDIO], is->ic->url);
+    if (is->switch_stream[AVMEDIA_TYPE_VIDEO] >= 0 && stream_component_open(is, is->switch_stream[AVMEDIA_TYPE_VIDEO]) < 0)
+        av_log(NULL, AV_LOG_ERROR, "Session %d cannot open video stream %d of %s\n",
+            is->id, is->switch_stream[AVMEDIA_TYPE_VIDEO], is->ic->url);
+    if (is->video_stream < 0 && is->audio_stream < 0)
+        ret = AVERROR_STREAM_NOT_FOUND;
+
+    SDL_LockMutex(is->continue_read_mutex);
+    is->switch_ret = ret;
+    is->switch_state = 0;
+    SDL_CondSignal(is->continue_read_thread);
+    SDL_UnlockMutex(is->continue_read_mutex);
+}
+
+/*
+ * reconnect with exponential backoff after the network went away. The session, the shared
+ * memory, the scaler and the control connection all stay,
+ * the host keeps showing the last picture until new ones arrive.
+ */
+static int stream_reconnect(VideoState* is)
+{
+    int64_t delay = RECONNECT_DELAY_MIN;
+    double pos = is->realtime ? NAN : get_master_clock(is);
+    int attempt;
+
+    /* the broken input and its decoders stay in place until a new input is open */
+    jitter_flush(&is->jitter_buf);
+    is->eof = 0;
+
+    for (attempt = 1; !is->abort_request; attempt++)
     {
+        /* random jitter, so many sessions behind the same switch do not retry in lockstep */
+        int64_t wait = delay + av_get_random_seed() % (delay / 2 + 1);
+        int64_t deadline = av_gettime_relative() + wait;
+        AVFormatContext* ic = NULL;
+        int st_index[AVMEDIA_TYPE_NB];
+
+        av_log(NULL, AV_LOG_WARNING, "Session %d lost %s, reconnect #%d in %" PRId64 " ms\n",
+            is->id, is->filename, attempt, wait / 1000);
+
+        SDL_LockMutex(is->continue_read_mutex);
+        while (!is->abort_request && av_gettime_relative() < deadline)
+            SDL_CondWaitTimeout(is->continue_read_thread, is->continue_read_mutex,
+                (Uint32)FFMAX((deadline - av_gettime_relative()) / 1000, 1));
+        SDL_UnlockMutex(is->continue_read_mutex);
         if (is->abort_request)
             break;
-        if (is->paused != is->last_paused)
-        {
-            is->last_paused = is->paused;
-            if (is->paused)
-                is->read_pause_return = av_read_pause(ic);
-            else
-                av_read_play(ic);
-        }
-#if CONFIG_RTSP_DEMUXER || CONFIG_MMSH_PROTOCOL
-        if (is->paused &&
-            (!strcmp(ic->iformat->name, "rtsp") ||
-                (ic->pb && !strncmp(input_filename, "mmsh:", 5))))
-        {
-            /* wait 10 ms to avoid trying to get another packet */
-            /* XXX: horrible */
-            SDL_Delay(10);
-            continue;
-        }
-#endif
-        if (is->seek_req)
-        {
-            int64_t seek_target = is->seek_pos;
-            int64_t seek_min = is->seek_rel > 0 ? seek_target - is->seek_rel + 2 : INT64_MIN;
-            int64_t seek_max = is->seek_rel < 0 ? seek_target - is->seek_rel - 2 : INT64_MAX;
-            // FIXME the +-2 is due to rounding being not done in the correct direction in generation
-            //      of the seek_pos/seek_rel variables
 
-            ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
-            if (ret < 0)
-            {
-                av_log(NULL, AV_LOG_ERROR,
-                    "%s: error while seeking\n", is->ic->url);
-            }
-            else
-            {
-                if (is->audio_stream >= 0)
-                    packet_queue_flush(&is->audioq);
-                if (is->video_stream >= 0)
-                    packet_queue_flush(&is->videoq);
-                if (is->seek_flags & AVSEEK_FLAG_BYTE)
-                {
-                    set_clock(&is->extclk, NAN, 0);
-                }
-                else
-                {
-                    set_clock(&is->extclk, seek_target / (double)AV_TIME_BASE, 0);
-                }
-            }
-            is->seek_req = 0;
-            is->queue_attachments_req = 1;
-            is->eof = 0;
-            if (is->paused)
-                step_to_next_frame(is);
-        }
-        if (is->queue_attachments_req)
+        if (stream_probe_input(is, &ic, st_index) >= 0 && stream_switch_input(is, &ic, st_index) >= 0)
         {
-            if (is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)
-            {
-                if ((ret = av_packet_ref(pkt, &is->video_st->attached_pic)) < 0)
-                    goto fail;
-                packet_queue_put(&is->videoq, pkt);
-                packet_queue_put_nullpacket(&is->videoq, pkt, is->video_stream);
-            }
-            is->queue_attachments_req = 0;
+            is->max_frame_duration = (is->ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
+            is->realtime = is_realtime(is->ic);
+            if (is->video_st && is->video_st->codecpar->width)
+                set_default_window_size(is, is->video_st->codecpar->width, is->video_st->codecpar->height,
+                    av_guess_sample_aspect_ratio(is->ic, is->video_st, NULL));
+            update_speed(is);
+            av_log(NULL, AV_LOG_INFO, "Session %d reconnected after %d attempts\n", is->id, attempt);
+            /* a file over the network continues where it stopped */
+            if (!is->realtime && !isnan(pos))
+                stream_seek(is, (int64_t)(pos * AV_TIME_BASE), 0, 0);
+            return 0;
         }
+        delay = FFMIN(delay * 2, RECONNECT_DELAY_MAX);
+    }
+    return AVERROR_EXIT;
+}
 
-        /* if the queue are full, no need to read more */
-        if (infinite_buffer < 1 &&
-            (is->audioq.size + is->videoq.size > MAX_QUEUE_SIZE || (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
-                stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq))))
-        {
-            /* wait 10 ms */
-            SDL_LockMutex(wait_mutex);
-            SDL_CondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
-            SDL_UnlockMutex(wait_mutex);
-            continue;
-        }
-        if (!is->paused &&
-            (!is->audio_st || (is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0)) &&
-            (!is->video_st || (is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->pictq) == 0)))
-        {
-            if (loop != 1 && (!loop || --loop))
-            {
-                stream_seek(is, start_time != AV_NOPTS_VALUE ? start_time : 0, 0, 0);
-            }
-            else if (autoexit)
-            {
-                ret = AVERROR_EOF;
-                goto fail;
-            }
-        }
-        ret = av_read_frame(ic, pkt);
-        if (ret < 0)
+/*
+ * while scanning, jump to the next keyframe that is due with the index,
+ * so the packets in between are not even read. Without an index the
+ * non-key packets are read and dropped before they reach the decoder.
+ */
+static void scan_next_keyframe(VideoState* is, int64_t pkt_ts)
+{
+    AVStream* st = is->video_st;
+    const AVIndexEntry* entry;
+    double clock = get_master_clock(is);
+    int64_t target;
+
+    if (!is->scan_index || pkt_ts == AV_NOPTS_VALUE || avformat_index_get_entries_count(st) <= 0)
+        return;
+
+    /* no more pictures than SCAN_MAX_RATE per second, and none behind the clock */
+    target = pkt_ts + FFMAX(av_rescale_q((int64_t)(is->speed * AV_TIME_BASE / SCAN_MAX_RATE),
+        AV_TIME_BASE_Q, st->time_base), 1);
+    if (!isnan(clock))
+        target = FFMAX(target, av_rescale_q((int64_t)(clock * AV_TIME_BASE) - is->item_offset, AV_TIME_BASE_Q, st->time_base));
+
+    /* past the end of the index, read on */
+    entry = avformat_index_get_entry_from_timestamp(st, target, 0);
+    if (!entry)
+        return;
+
+    if (avformat_seek_file(is->ic, is->video_stream, entry->timestamp, entry->timestamp, INT64_MAX, 0) < 0)
+    {
+        av_log(NULL, AV_LOG_VERBOSE, "Session %d cannot seek by index, scanning all packets\n", is->id);
+        is->scan_index = 0;
+    }
+}
+
+/* decode from the keyframe up to the target, the first frame queued is the target itself */
+static void stream_set_seek_target(VideoState* is, int64_t seek_target)
+{
+    is->seek_target = seek_target / (double)AV_TIME_BASE;
+    is->seek_video_serial = is->video_st ? is->videoq.serial : -1;
+    is->seek_audio_serial = is->audio_st ? is->audioq.serial : -1;
+    if (is->video_st)
+    {
+        is->viddec.preroll_pts = av_rescale_q(seek_target, AV_TIME_BASE_Q, is->viddec.avctx->pkt_timebase);
+        is->viddec.preroll_serial = is->videoq.serial;
+    }
+}
+
+/*
+ * the background keyframe table lands right on the keyframe before the target.
+ * Targets are on the timeline, a playlist item has its own timestamps.
+ */
+static int stream_seek_file(VideoState* is, int64_t seek_min, int64_t seek_target, int64_t seek_max)
+{
+    KeyIndexEntry entry;
+
+    if (!(is->seek_flags & AVSEEK_FLAG_BYTE) && is->item_offset)
+    {
+        seek_target -= is->item_offset;
+        if (seek_min != INT64_MIN)
+            seek_min -= is->item_offset;
+        if (seek_max != INT64_MAX)
+            seek_max -= is->item_offset;
+    }
+    if (!(is->seek_flags & AVSEEK_FLAG_BYTE) && is->video_st &&
+        keyindex_lookup(&is->keyindex, av_rescale_q(seek_target, AV_TIME_BASE_Q, is->video_st->time_base), &entry))
+    {
+        int64_t ts = av_rescale_q(entry.ts, is->video_st->time_base, AV_TIME_BASE_Q);
+
+        if (ts >= seek_min && ts <= seek_max &&
+            avformat_seek_file(is->ic, -1, INT64_MIN, entry.pos, INT64_MAX, AVSEEK_FLAG_BYTE) >= 0)
+            return 0;
+    }
+    return avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
+}
+
+/* the next pass of a looping clip comes from memory, 0 when the clip is not cached */
+static int loop_replay_start(VideoState* is, AVPacket* pkt)
+{
+    loop_cache_finish(&is->loopc);
+    if (is->loopc.state != LOOP_CACHE_READY)
+        return 0;
+
+    loop_cache_rewind(&is->loopc);
+    if (is->audio_stream >= 0)
+        packet_queue_flush(&is->audioq);
+    if (is->video_stream >= 0)
+        packet_queue_flush(&is->videoq);
+    set_clock(&is->extclk, is->loopc.start != AV_NOPTS_VALUE ? is->loopc.start / (double)AV_TIME_BASE : NAN, 0);
+    is->eof = 0;
+    is->loop_replay = 1;
+
+    /* the video thread waits for a packet, an empty one wakes it up for the pictures */
+    if (is->video_stream >= 0 && is->loopc.pictures_state == LOOP_CACHE_READY)
+    {
+        is->loop_replay = 2;
+        is->loop_replay_serial = is->videoq.serial;
+        packet_queue_put_nullpacket(&is->videoq, pkt, is->video_stream);
+    }
+    return 1;
+}
+
+/* local files the demuxer cannot seek well get a keyframe table built in the background */
+static void stream_start_keyindex(VideoState* is)
+{
+    if (is->keyindex_mode < 0)
+        is->keyindex_mode = !strstr(is->filename, "://") || !strncmp(is->filename, "file:", 5);
+    if (is->keyindex_mode > 0 && !is->realtime && is->ic->pb && is->video_st &&
+        !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC) &&
+        (is->seek_by_bytes || avformat_index_get_entries_count(is->video_st) <= 0))
+        keyindex_start(&is->keyindex, is->filename, is->index_dir, is->video_st->id, is->video_st->time_base);
+}
+
+/*
+ * playlist items continue the timeline of the running decoders: the timestamps
+ * are moved behind the previous item and into the time base the decoder was opened with.
+ * Returns the time base of the packet afterwards.
+ */
+static AVRational stream_map_packet(VideoState* is, AVPacket* pkt)
+{
+    AVStream* st = is->ic->streams[pkt->stream_index];
+    AudioTrack* track = audio_mix_track(&is->audio_mix, pkt->stream_index);
+    Decoder* d = pkt->stream_index == is->video_stream ? &is->viddec : track ? &track->dec : &is->auddec;
+    int type = st->codecpar->codec_type;
+    AVRational tb = d->avctx->pkt_timebase;
+    int64_t offset = av_rescale_q(is->item_offset, AV_TIME_BASE_Q, tb);
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts = av_rescale_q(pkt->pts, st->time_base, tb) + offset;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts = av_rescale_q(pkt->dts, st->time_base, tb) + offset;
+    pkt->duration = av_rescale_q(pkt->duration, st->time_base, tb);
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+    {
+        int64_t end = av_rescale_q(pkt->pts + pkt->duration, tb, AV_TIME_BASE_Q);
+
+        if (is->item_end == AV_NOPTS_VALUE || end > is->item_end)
+            is->item_end = end;
+    }
+
+    /* same codec, other parameter sets: the decoder picks them up from the side data */
+    if (is->item_extradata & (1 << type))
+    {
+        uint8_t* data = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, st->codecpar->extradata_size);
+
+        if (data)
+            memcpy(data, st->codecpar->extradata, st->codecpar->extradata_size);
+        is->item_extradata &= ~(1 << type);
+    }
+    return tb;
+}
+
+/* live packets go through the jitter buffer when it runs */
+static void read_thread_queue(VideoState* is, PacketQueue* q, AVPacket* pkt)
+{
+    AVRational tb = is->ic->streams[pkt->stream_index]->time_base;
+
+    if (is->playlist.nb_urls)
+        tb = stream_map_packet(is, pkt);
+    if (is->jitter > 0)
+        jitter_put(&is->jitter_buf, q, pkt, tb);
+    else
+        packet_queue_put(q, pkt);
+}
+
+/* runs on the playlist thread */
+static int playlist_open_item(void* opaque, const char* url, PlaylistNext* next)
+{
+    VideoState* is = opaque;
+    int st_index[AVMEDIA_TYPE_NB];
+    int ret;
+
+    if ((ret = stream_open_format(is, url, &next->ic)) < 0)
+        return ret;
+    stream_find_streams(is, next->ic, st_index);
+    next->video_stream = st_index[AVMEDIA_TYPE_VIDEO] >= 0 ? st_index[AVMEDIA_TYPE_VIDEO] : -1;
+    next->audio_stream = st_index[AVMEDIA_TYPE_AUDIO] >= 0 ? st_index[AVMEDIA_TYPE_AUDIO] : -1;
+    if (next->video_stream < 0 && next->audio_stream < 0)
+    {
+        avformat_close_input(&next->ic);
+        return AVERROR_STREAM_NOT_FOUND;
+    }
+    if (next->video_stream >= 0)
+        next->ic->streams[next->video_stream]->discard = AVDISCARD_DEFAULT;
+    if (next->audio_stream >= 0)
+        next->ic->streams[next->audio_stream]->discard = AVDISCARD_DEFAULT;
+    return 0;
+}
+
+static void playlist_wake(void* opaque)
+{
+    stream_wake_read_thread(opaque);
+}
+
+static void stream_prepare_next(VideoState* is)
+{
+    /* -loop counts passes over the whole list */
+    int index = playlist_next_index(&is->playlist, is->loop != 1);
+
+    if (index >= 0)
+        playlist_prepare(&is->playlist, index);
+}
+
+/* the running decoders can go on with the next item */
+static int stream_item_compatible(VideoState* is, PlaylistNext* next)
+{
+    AVStream* vst = next->video_stream >= 0 ? next->ic->streams[next->video_stream] : NULL;
+    AVStream* ast = next->audio_stream >= 0 ? next->ic->streams[next->audio_stream] : NULL;
+
+    /* the mixed tracks are opened again from the streams of the new item */
+    if (!vst != !is->video_st || !ast != !is->audio_st || is->audio_mix.nb_tracks)
+        return 0;
+    if (vst && (vst->codecpar->codec_id != is->video_st->codecpar->codec_id ||
+        ((vst->disposition | is->video_st->disposition) & AV_DISPOSITION_ATTACHED_PIC)))
+        return 0;
+    if (ast && ast->codecpar->codec_id != is->audio_st->codecpar->codec_id)
+        return 0;
+    return 1;
+}
+
+static int stream_extradata_changed(AVStream* st, AVStream* prev)
+{
+    return st->codecpar->extradata_size &&
+        (st->codecpar->extradata_size != prev->codecpar->extradata_size ||
+            memcmp(st->codecpar->extradata, prev->codecpar->extradata, st->codecpar->extradata_size));
+}
+
+/*
+ * the prepared item takes over at the end of the current one. With the same codecs
+ * the decoders keep running and the timestamps continue, so there is no gap.
+ * Anything else waits until the decoders are drained and opens them again.
+ * 1 switched, 0 nothing to switch to now, AVERROR(EAGAIN) the next item is still opening
+ */
+static int stream_next_item(VideoState* is, AVPacket* pkt, int drained)
+{
+    Playlist* pl = &is->playlist;
+    PlaylistNext next;
+    int st_index[AVMEDIA_TYPE_NB];
+    int state, same = 0, wrap, i, ret;
+
+    stream_prepare_next(is);
+    state = playlist_state(pl);
+    if (state == PLAYLIST_NEXT_NONE)
+        return 0;
+    if (state != PLAYLIST_NEXT_READY && state != PLAYLIST_NEXT_FAILED)
+        return AVERROR(EAGAIN);
+    if (state == PLAYLIST_NEXT_READY)
+    {
+        same = stream_item_compatible(is, &pl->next);
+        if (!same && !drained)
+            return 0;
+    }
+
+    wrap = pl->next.index <= pl->current;
+    ret = playlist_take(pl, &next);
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_WARNING, "Session %d skips playlist item %d\n", is->id, next.index);
+        playlist_next_free(&next);
+        stream_prepare_next(is);
+        return AVERROR(EAGAIN);
+    }
+    if (wrap && is->loop > 1)
+        is->loop--;
+
+    keyindex_stop(&is->keyindex);
+    avformat_close_input(&is->prev_ic);
+    if (same)
+    {
+        /* the drained decoders only start again on a new serial */
+        if (drained)
         {
-            if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->eof)
+            if (is->audio_stream >= 0)
+                packet_queue_flush(&is->audioq);
+            if (is->video_stream >= 0)
+                packet_queue_flush(&is->videoq);
+        }
+        is->item_extradata = 0;
+        if (is->video_st && stream_extradata_changed(next.ic->streams[next.video_stream], is->video_st))
+            is->item_extradata |= 1 << AVMEDIA_TYPE_VIDEO;
+        if (is->audio_st && stream_extradata_changed(next.ic->streams[next.audio_stream], is->audio_st))
+            is->item_extradata |= 1 << AVMEDIA_TYPE_AUDIO;
+
+        is->prev_ic = is->ic;
+        is->ic = next.ic;
+        if (is->video_st)
+        {
+            is->video_stream = is->last_video_stream = next.video_stream;
+            is->video_st = is->ic->streams[next.video_stream];
+            update_video_discard(is);
+        }
+        if (is->audio_st)
+        {
+            is->audio_stream = is->last_audio_stream = next.audio_stream;
+            is->audio_st = is->ic->streams[next.audio_stream];
+        }
+    }
+    else
+    {
+        av_log(NULL, AV_LOG_WARNING, "Session %d opens new decoders for playlist item %d, the switch is not gapless\n",
+            is->id, next.index);
+        for (i = 0; i < AVMEDIA_TYPE_NB; i++)
+            st_index[i] = -1;
+        st_index[AVMEDIA_TYPE_AUDIO] = next.audio_stream;
+        st_index[AVMEDIA_TYPE_VIDEO] = next.video_stream;
+        if (stream_switch_input(is, &next.ic, st_index) < 0 && !is->abort_request)
+            av_log(NULL, AV_LOG_ERROR, "Session %d cannot open the decoders for playlist item %d\n", is->id, next.index);
+    }
+    next.ic = NULL;
+
+    /* the first picture of the item is due right where the last one ends */
+    is->item_offset = (is->item_end != AV_NOPTS_VALUE ? is->item_end : is->item_offset) - next.start;
+    is->item_end = AV_NOPTS_VALUE;
+    is->max_frame_duration = (is->ic->iformat->flags & AVFMT_TS_DISCONT) ? 10.0 : 3600.0;
+    is->realtime = is_realtime(is->ic);
+    is->eof = 0;
+    av_free(is->filename);
+    is->filename = next.url;
+    next.url = NULL;
+
+    if (is->video_st)
+        set_default_window_size(is, is->video_st->codecpar->width, is->video_st->codecpar->height,
+            av_guess_sample_aspect_ratio(is->ic, is->video_st, NULL));
+    stream_start_keyindex(is);
+    update_speed(is);
+
+    /* nothing to decode: the item ends right away and the next one follows */
+    if (is->video_stream < 0 && is->audio_stream < 0)
+    {
+        playlist_next_free(&next);
+        return 0;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "Session %d plays playlist item %d: %s\n", is->id, next.index, is->filename);
+    for (i = 0; i < next.nb_packets; i++)
+    {
+        av_packet_move_ref(pkt, next.packets[i]);
+        if (pkt->stream_index == is->audio_stream && is->speed <= AUDIO_SPEED_MAX)
+            read_thread_queue(is, &is->audioq, pkt);
+        else if (pkt->stream_index == is->video_stream)
+            read_thread_queue(is, &is->videoq, pkt);
+        else
+            av_packet_unref(pkt);
+    }
+    playlist_next_free(&next);
+    stream_prepare_next(is);
+    return 1;
+}
+
+/*
+ * paused, or a finished file that neither loops nor exits: nothing happens
+ * until a seek, a resume or close wakes the thread, so sleep without a timeout
+ */
+static void read_thread_wait(VideoState* is)
+{
+    SDL_LockMutex(is->continue_read_mutex);
+    if (!is->abort_request && !is->seek_req && is->paused == is->last_paused &&
+        (is->paused || (is->eof && !is->realtime && is->loop == 1 && !autoexit)))
+        SDL_CondWait(is->continue_read_thread, is->continue_read_mutex);
+    else
+        SDL_CondWaitTimeout(is->continue_read_thread, is->continue_read_mutex, 10);
+    SDL_UnlockMutex(is->continue_read_mutex);
+}
+
+/* this thread gets the stream from the disk or the network */
+static int read_thread(void* arg)
+{
+    VideoState* is = arg;
+    AVFormatContext* ic = NULL;
+    int ret;
+    AVPacket* pkt = NULL;
+    int64_t stream_start_time;
+    int pkt_in_play_range = 0;
+    int64_t pkt_ts;
+    AudioTrack* track;
+
+    is->eof = 0;
+
+    pkt = av_packet_alloc();
+    if (!pkt)
+    {
+        av_log(NULL, AV_LOG_FATAL, "Could not allocate packet.\n");
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    /* a playlist input plays its first item, the others follow */
+    if (is->playlist_file)
+    {
+        char* url;
+
+        if ((ret = playlist_load(&is->playlist, is->filename)) < 0)
+            goto fail;
+        if (!(url = playlist_url(&is->playlist, 0)))
+        {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        av_free(is->filename);
+        is->filename = url;
+    }
+    ret = stream_open_input(is);
+    if (ret < 0)
+        goto fail;
+    ic = is->ic;
+
+    if (is->infinite_buffer < 0 && is->realtime)
+        is->infinite_buffer = 1;
+
+    stream_start_keyindex(is);
+
+    if (is->loop != 1 && !is->realtime && !is->playlist.nb_urls && loop_cache_init(&is->loopc, is->loop_cache_size, is->loop_cache_max) < 0)
+        goto fail;
+
+    /* jitter buffering only pays off for packets arriving straight from the network */
+    if (is->jitter < 0)
+        is->jitter = !is->nobuffer && (is->realtime || !strncmp(is->filename, "srt:", 4));
+    if (is->jitter > 0)
+    {
+        if (jitter_init(&is->jitter_buf, is->jitter_min, is->jitter_max) < 0)
+            is->jitter = 0;
+        else
+            av_log(NULL, AV_LOG_INFO, "Session %d jitter buffer %" PRId64 "-%" PRId64 " ms\n",
+                is->id, is->jitter_min / 1000, is->jitter_max / 1000);
+    }
+
+    for (;;)
+    {
+        if (is->abort_request)
+            break;
+        if (is->paused != is->last_paused)
+        {
+            is->last_paused = is->paused;
+            if (is->paused)
+                is->read_pause_return = av_read_pause(ic);
+            else
+                av_read_play(ic);
+        }
+#if CONFIG_RTSP_DEMUXER || CONFIG_MMSH_PROTOCOL
+        if (is->paused &&
+            (!strcmp(ic->iformat->name, "rtsp") ||
+                (ic->pb && !strncmp(is->filename, "mmsh:", 5))))
+        {
+            /* sleep until resumed instead of trying to get another packet */
+            read_thread_wait(is);
+            continue;
+        }
+#endif
+        if (is->seek_req)
+        {
+            int64_t seek_target = is->seek_pos;
+            int64_t seek_min = is->seek_rel > 0 ? seek_target - is->seek_rel + 2 : INT64_MIN;
+            int64_t seek_max = is->seek_rel < 0 ? seek_target - is->seek_rel - 2 : INT64_MAX;
+            // FIXME the +-2 is due to rounding being not done in the correct direction in generation
+            //      of the seek_pos/seek_rel variables
+
+            ret = stream_seek_file(is, seek_min, seek_target, seek_max);
+            if (ret < 0)
             {
-                if (is->video_stream >= 0)
-                    packet_queue_put_nullpacket(&is->videoq, pkt, is->video_stream);
+                av_log(NULL, AV_LOG_ERROR,
+                    "%s: error while seeking\n", is->ic->url);
+            }
+            else
+            {
+                jitter_flush(&is->jitter_buf);
+                is->item_end = AV_NOPTS_VALUE;
                 if (is->audio_stream >= 0)
-                    packet_queue_put_nullpacket(&is->audioq, pkt, is->audio_stream);
-                is->eof = 1;
+                    packet_queue_flush(&is->audioq);
+                audio_mix_flush(&is->audio_mix);
+                if (is->video_stream >= 0)
+                    packet_queue_flush(&is->videoq);
+                if (is->seek_flags & AVSEEK_FLAG_BYTE)
+                {
+                    set_clock(&is->extclk, NAN, 0);
+                }
+                else
+                {
+                    set_clock(&is->extclk, seek_target / (double)AV_TIME_BASE, 0);
+                }
+                if (is->gop_fill_req)
+                {
+                    /* every frame up to the target goes into the step cache instead */
+                    is->gop_fill_serial = is->videoq.serial;
+                }
+                else if ((is->accurate_seek || is->seek_accurate_req) && !(is->seek_flags & AVSEEK_FLAG_BYTE))
+                {
+                    stream_set_seek_target(is, seek_target);
+                }
             }
-            if (ic->pb && ic->pb->error)
+            /* a seek in the first pass leaves the loop cache with a hole */
+            if (is->loopc.state == LOOP_CACHE_RECORDING)
+                loop_cache_abort(&is->loopc);
+            is->loop_replay = 0;
+            is->seek_req = 0;
+            is->seek_accurate_req = 0;
+            is->gop_fill_req = 0;
+            is->queue_attachments_req = 1;
+            is->eof = 0;
+            if (is->paused)
+                step_to_next_frame(is);
+        }
+        if (is->queue_attachments_req)
+        {
+            if (is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)
             {
-                if (autoexit)
+                if ((ret = av_packet_ref(pkt, &is->video_st->attached_pic)) < 0)
                     goto fail;
-                else
-                    break;
+                packet_queue_put(&is->videoq, pkt);
+                packet_queue_put_nullpacket(&is->videoq, pkt, is->video_stream);
+            }
+            is->queue_attachments_req = 0;
+        }
+
+        /* if the queue are full, no need to read more */
+        if (is->infinite_buffer < 1 &&
+            (is->audioq.size + is->videoq.size + audio_mix_queue_size(&is->audio_mix) > MAX_QUEUE_SIZE ||
+                ((is->speed > AUDIO_SPEED_MAX || (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
+                    audio_mix_has_enough_packets(&is->audio_mix, ic))) &&
+                (is->loop_replay == 2 || stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq)))))
+        {
+            /* wait 10 ms, or until woken up while paused */
+            read_thread_wait(is);
+            continue;
+        }
+        if (!is->paused &&
+            (!is->audio_st || (is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0)) &&
+            (!is->video_st || (is->loop_replay_serial < 0 && is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->pictq) == 0)))
+        {
+            if (is->playlist.nb_urls)
+            {
+                /* only an item with other codecs waits for the decoders to drain */
+                ret = stream_next_item(is, pkt, 1);
+                if (ret > 0)
+                {
+                    ic = is->ic;
+                    continue;
+                }
+                if (!ret && autoexit)
+                {
+                    ret = AVERROR_EOF;
+                    goto fail;
+                }
+            }
+            else if (is->loop != 1 && (!is->loop || --is->loop))
+            {
+                if (!loop_replay_start(is, pkt))
+                    stream_seek(is, start_time != AV_NOPTS_VALUE ? start_time : 0, 0, 0);
+            }
+            else if (autoexit)
+            {
+                ret = AVERROR_EOF;
+                goto fail;
+            }
+        }
+        if (is->loop_replay)
+            ret = loop_cache_next_packet(&is->loopc, pkt) ? 0 : AVERROR_EOF;
+        else
+            ret = av_read_frame(ic, pkt);
+        if (ret < 0)
+        {
+            if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->eof && is->playlist.nb_urls)
+            {
+                ret = stream_next_item(is, pkt, 0);
+                if (ret > 0)
+                {
+                    ic = is->ic;
+                    continue;
+                }
+                if (ret == AVERROR(EAGAIN))
+                {
+                    read_thread_wait(is);
+                    continue;
+                }
+                ret = AVERROR_EOF;
+            }
+            if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->eof)
+            {
+                if (is->video_stream >= 0)
+                    packet_queue_put_nullpacket(&is->videoq, pkt, is->video_stream);
+                if (is->audio_stream >= 0)
+                    packet_queue_put_nullpacket(&is->audioq, pkt, is->audio_stream);
+                audio_mix_put_nullpackets(&is->audio_mix, pkt);
+                is->eof = 1;
+            }
+            /* a live source that ends or any broken connection: try to get it back */
+            if (is->reconnect && ret != AVERROR(EAGAIN) &&
+                ((ic->pb && ic->pb->error) || is->realtime))
+            {
+                if (stream_reconnect(is) < 0)
+                    break;
+                ic = is->ic;
+                is->last_paused = 0;
+                continue;
+            }
+            if (ic->pb && ic->pb->error)
+            {
+                if (autoexit)
+                    goto fail;
+                else
+                    break;
+            }
+            read_thread_wait(is);
+            continue;
+        }
+        else
+        {
+            is->eof = 0;
+        }
+        /* audio is dropped at scan speeds, such a pass cannot be replayed, a playlist or mixed tracks never are */
+        if ((is->speed > AUDIO_SPEED_MAX || is->playlist.nb_urls || is->audio_mix.nb_tracks) && is->loopc.state == LOOP_CACHE_RECORDING)
+            loop_cache_abort(&is->loopc);
+        if (is->playlist.nb_urls)
+            stream_prepare_next(is);
+        /* check if packet is in play range specified by user, then queue, otherwise discard */
+        stream_start_time = ic->streams[pkt->stream_index]->start_time;
+        pkt_ts = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+        pkt_in_play_range = duration == AV_NOPTS_VALUE ||
+            (pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
+            av_q2d(ic->streams[pkt->stream_index]->time_base) -
+            (double)(start_time != AV_NOPTS_VALUE ? start_time : 0) / 1000000 <=
+            ((double)duration / 1000000);
+        /* audio is time stretched up to AUDIO_SPEED_MAX and dropped above */
+        if (pkt->stream_index == is->audio_stream && pkt_in_play_range && is->speed <= AUDIO_SPEED_MAX)
+        {
+            loop_cache_add_packet(&is->loopc, pkt, ic->streams[pkt->stream_index]->time_base);
+            read_thread_queue(is, &is->audioq, pkt);
+        }
+        else if ((track = audio_mix_track(&is->audio_mix, pkt->stream_index)) && pkt_in_play_range && is->speed <= AUDIO_SPEED_MAX)
+        {
+            read_thread_queue(is, &track->q, pkt);
+        }
+        else if (pkt->stream_index == is->video_stream && pkt_in_play_range && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        {
+            /* the pictures come from memory, nothing to decode */
+            if ((is->scan && !(pkt->flags & AV_PKT_FLAG_KEY)) || is->loop_replay == 2)
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            loop_cache_add_packet(&is->loopc, pkt, ic->streams[pkt->stream_index]->time_base);
+            read_thread_queue(is, &is->videoq, pkt);
+            if (is->scan)
+                scan_next_keyframe(is, pkt_ts);
+        }
+        else
+        {
+            av_packet_unref(pkt);
+        }
+    }
+
+    ret = 0;
+fail:
+    av_packet_free(&pkt);
+    if (ret != 0)
+    {
+        push_quit_event(is);
+    }
+    return 0;
+}
+
+static VideoState* stream_open(const char* filename, VideoState* is, int volume)
+{
+    is->last_video_stream = is->video_stream = -1;
+    is->last_audio_stream = is->audio_stream = -1;
+    is->filename = av_strdup(filename);
+    if (!is->filename)
+        goto fail;
+
+    /* start video display */
+    if (frame_queue_init(&is->pictq, &is->videoq, VIDEO_PICTURE_QUEUE_SIZE, 1) < 0)
+        goto fail;
+    if (frame_queue_init(&is->sampq, &is->audioq, SAMPLE_QUEUE_SIZE, 1) < 0)
+        goto fail;
+
+    if (packet_queue_init(&is->videoq) < 0 ||
+        packet_queue_init(&is->audioq) < 0)
+        goto fail;
+
+    if (!(is->continue_read_thread = SDL_CreateCond()) || !(is->continue_read_mutex = SDL_CreateMutex()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
+        goto fail;
+    }
+
+    if (!(is->convert_mutex = SDL_CreateMutex()) || !(is->convert_cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        goto fail;
+    }
+    if (!(is->convert_frame = av_frame_alloc()))
+        goto fail;
+    if (gop_cache_init(&is->gop, is->step_cache_size) < 0)
+        goto fail;
+    if (playlist_init(&is->playlist, playlist_open_item, playlist_wake, is) < 0)
+        goto fail;
+
+    init_clock(&is->vidclk, &is->videoq.serial);
+    init_clock(&is->audclk, &is->audioq.serial);
+    init_clock(&is->extclk, &is->extclk.serial);
+    is->audio_clock_serial = -1;
+    if (volume < 0)
+        av_log(NULL, AV_LOG_WARNING, "-volume=%d < 0, setting to 0\n", volume);
+    if (volume > 100)
+        av_log(NULL, AV_LOG_WARNING, "-volume=%d > 100, setting to 100\n", volume);
+    volume = av_clip(volume, 0, 100);
+    volume = av_clip(SDL_MIX_MAXVOLUME * volume / 100, 0, SDL_MIX_MAXVOLUME);
+    is->audio_volume = volume;
+    is->muted = 0;
+    is->av_sync_type = av_sync_type;
+    is->read_tid = SDL_CreateThread(read_thread, "read_thread", is);
+    if (!is->read_tid)
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+    fail:
+        stream_close(is);
+        return NULL;
+    }
+    return is;
+}
+
+static void stream_cycle_channel(VideoState* is, int codec_type)
+{
+    AVFormatContext* ic = is->ic;
+    int start_index, stream_index;
+    int old_index;
+    AVStream* st;
+    AVProgram* p = NULL;
+    int nb_streams = is->ic->nb_streams;
+
+    if (codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+        start_index = is->last_video_stream;
+        old_index = is->video_stream;
+    }
+    else if (codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+        /* the tracks are decoded already, only the gains change */
+        if (is->audio_mix.nb_tracks)
+        {
+            av_log(NULL, AV_LOG_INFO, "Switch to audio track %d\n", audio_mix_solo_next(&is->audio_mix));
+            return;
+        }
+        start_index = is->last_audio_stream;
+        old_index = is->audio_stream;
+    }
+    stream_index = start_index;
+
+    if (codec_type != AVMEDIA_TYPE_VIDEO && is->video_stream != -1)
+    {
+        p = av_find_program_from_stream(ic, NULL, is->video_stream);
+        if (p)
+        {
+            nb_streams = p->nb_stream_indexes;
+            for (start_index = 0; start_index < nb_streams; start_index++)
+                if (p->stream_index[start_index] == stream_index)
+                    break;
+            if (start_index == nb_streams)
+                start_index = -1;
+            stream_index = start_index;
+        }
+    }
+
+    for (;;)
+    {
+        if (++stream_index >= nb_streams)
+        {
+            if (start_index == -1)
+                return;
+            stream_index = 0;
+        }
+        if (stream_index == start_index)
+            return;
+        st = is->ic->streams[p ? p->stream_index[stream_index] : stream_index];
+        if (st->codecpar->codec_type == codec_type)
+        {
+            /* check that parameters are OK */
+            switch (codec_type)
+            {
+            case AVMEDIA_TYPE_AUDIO:
+                if (st->codecpar->sample_rate != 0 &&
+                    st->codecpar->ch_layout.nb_channels != 0)
+                    goto the_end;
+                break;
+            case AVMEDIA_TYPE_VIDEO:
+                goto the_end;
+            default:
+                break;
+            }
+        }
+    }
+the_end:
+    if (p && stream_index != -1)
+        stream_index = p->stream_index[stream_index];
+    av_log(NULL, AV_LOG_INFO, "Switch %s stream from #%d to #%d\n",
+        av_get_media_type_string(codec_type),
+        old_index,
+        stream_index);
+
+    stream_component_close(is, old_index);
+    stream_component_open(is, stream_index);
+}
+
+/* nothing left for video_refresh() until a command, a seek or a new picture arrives */
+static int session_idle(VideoState* is)
+{
+    if (is->force_refresh || is->step_back_ready)
+        return 0;
+    if (is->show_mode == SHOW_MODE_NONE || is->paused)
+        return 1;
+    /*
+     * still picture, cover art, the end of the file or simply waiting for the decoder:
+     * queue_picture() wakes the loop when the next picture is there
+     */
+    return !is->video_st || frame_queue_nb_remaining(&is->pictq) == 0;
+}
+
+static void wait_wakeup(void)
+{
+    SDL_LockMutex(wake_mutex);
+    while (!wake_pending && !need_exit)
+        SDL_CondWait(wake_cond, wake_mutex);
+    wake_pending = 0;
+    SDL_UnlockMutex(wake_mutex);
+}
+
+static void refresh_loop_wait_event(SDL_Event* event)
+{
+    double remaining_time = 0.0;
+    SDL_PumpEvents();
+    while (!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT))
+    {
+        int active = 0;
+
+        if (!cursor_hidden && av_gettime_relative() - cursor_last_shown > CURSOR_HIDE_DELAY)
+        {
+            SDL_ShowCursor(0);
+            cursor_hidden = 1;
+        }
+        if (remaining_time > 0.0)
+            av_usleep((int64_t)(remaining_time * 1000000.0));
+        remaining_time = REFRESH_RATE;
+        for (int i = 0; i < nb_sessions; i++)
+        {
+            VideoState* is = sessions[i];
+            if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
+                video_refresh(is, &remaining_time);
+            if (!session_idle(is))
+                active = 1;
+        }
+        SDL_PumpEvents();
+        if (need_exit)
+        {
+            do_exit();
+        }
+        /* paused, still or finished sessions only: block instead of polling */
+        if (!active && !SDL_PeepEvents(NULL, 0, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT))
+        {
+            wait_wakeup();
+            remaining_time = 0.0;
+            if (need_exit)
+                do_exit();
+        }
+    }
+}
+
+static VideoState* session_find(int id)
+{
+    for (int i = 0; i < nb_sessions; i++)
+    {
+        if (sessions[i]->id == id)
+            return sessions[i];
+    }
+    return NULL;
+}
+
+static int parse_priority(const char* name)
+{
+    if (!strcmp(name, "low"))
+        return POOL_PRIORITY_LOW;
+    if (!strcmp(name, "high"))
+        return POOL_PRIORITY_HIGH;
+    if (!strcmp(name, "normal"))
+        return POOL_PRIORITY_NORMAL;
+    return av_clip(atoi(name), POOL_PRIORITY_LOW, POOL_PRIORITY_HIGH);
+}
+
+static void session_set_visible(VideoState* is, int visible, int keyonly)
+{
+    int was_keyonly = is->hidden && is->hidden_keyonly;
+
+    is->hidden = !visible;
+    is->hidden_keyonly = keyonly;
+    update_video_discard(is);
+
+    /* hidden pictures are not converted, so the loop cache cannot have them all */
+    if (!visible && is->loopc.pictures_state == LOOP_CACHE_RECORDING)
+        loop_cache_drop_pictures(&is->loopc);
+
+    if (!visible)
+        return;
+
+    /* show the current picture again right away */
+    is->dirty_reset = 1;
+    is->force_refresh = 1;
+    if (is->pictq.rindex_shown)
+        frame_queue_peek_last(&is->pictq)->uploaded = 0;
+
+    /* a file can jump to the next keyframe at the master clock instead of waiting for one */
+    if (was_keyonly && is->video_st && !is->realtime && is->ic)
+    {
+        double pos = get_master_clock(is);
+
+        if (!isnan(pos))
+            stream_seek(is, (int64_t)(pos * AV_TIME_BASE), 0, 0);
+    }
+}
+
+/* payload is "url\0[url\0...]", a single input becomes the first item */
+static void session_playlist_add(VideoState* is, char* data, int size)
+{
+    char* p = data;
+    char* end = data + size;
+
+    if (!is->playlist.nb_urls && !is->playlist_file && playlist_append(&is->playlist, is->filename) < 0)
+        return;
+    while (p < end)
+    {
+        if (*p && playlist_append(&is->playlist, p) < 0)
+            break;
+        p += strlen(p) + 1;
+    }
+    /* a finished playlist goes on with the new items */
+    stream_wake_read_thread(is);
+}
+
+static void session_set_speed(VideoState* is, double speed)
+{
+    double pos = get_master_clock(is);
+    int was_scan = is->scan;
+    int had_audio = is->speed <= AUDIO_SPEED_MAX;
+
+    is->speed = av_clipd(speed, SPEED_MIN, SPEED_MAX);
+    /* not open yet, the read thread applies it */
+    if (!is->ic)
+        return;
+    update_speed(is);
+
+    /* the queues hold packets for the other mode, start again at the current position */
+    if ((is->scan != was_scan || (is->speed <= AUDIO_SPEED_MAX) != had_audio) && !is->realtime && !isnan(pos))
+        stream_seek(is, (int64_t)(pos * AV_TIME_BASE), 0, 0);
+    is->force_refresh = 1;
+}
+
+static VideoState* session_create(int id, const char* filename, int max_width, int max_height,
+    const char* mem_name, int argc, char** argv)
+{
+    VideoState* is;
+    int volume = startup_volume;
+
+    if (session_find(id))
+    {
+        av_log(NULL, AV_LOG_ERROR, "Session %d already exists\n", id);
+        return NULL;
+    }
+    if (nb_sessions >= MAX_SESSIONS)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Too many sessions, max is %d\n", MAX_SESSIONS);
+        return NULL;
+    }
+
+    is = av_mallocz(sizeof(VideoState));
+    if (!is)
+        return NULL;
+
+    is->id = id;
+    is->img_max_width = max_width;
+    is->img_max_height = max_height;
+    is->seek_by_bytes = -1;
+    is->fps_serial = -1;
+    is->speed = 1.0;
+    is->keyindex_mode = -1;
+    is->seek_video_serial = -1;
+    is->seek_audio_serial = -1;
+    is->gop_fill_serial = -1;
+    is->step_cache_size = STEP_CACHE_SIZE;
+    is->loop_cache_size = LOOP_CACHE_SIZE;
+    is->loop_cache_max = LOOP_CACHE_MAX;
+    is->audio_ring_ms = AUDIO_RING_MS;
+    is->audio_float = 1;
+    is->resample_profile = RESAMPLE_DEFAULT;
+    is->audio_filter_tempo = 1.0;
+    audio_mix_init(&is->audio_mix);
+    is->loop_replay_serial = -1;
+    is->item_end = AV_NOPTS_VALUE;
+    /* network inputs come back on their own after a drop */
+    is->reconnect = strstr(filename, "://") && strncmp(filename, "file:", 5);
+    skip_controller_init(&is->skip, 1);
+    is->jitter = -1;
+    is->jitter_min = 20000;
+    is->jitter_max = 500000;
+    is->infinite_buffer = -1;
+    is->loop = 1;
+    is->priority = POOL_PRIORITY_NORMAL;
+    is->mem_name = av_strdup(mem_name);
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp("-disable_audio", argv[i]) == 0)
+        {
+            is->disable_audio = 1;
+        }
+        else if (strcmp("-dirty", argv[i]) == 0)
+        {
+            is->dirty_detect = 1;
+        }
+        else if (strcmp("-dirty_header", argv[i]) == 0)
+        {
+            is->dirty_detect = 1;
+            is->dirty_header = 1;
+        }
+        else if (strcmp("-nobuffer", argv[i]) == 0)
+        {
+            is->nobuffer = 1;
+        }
+        else if (strcmp("-hw_disable", argv[i]) == 0)
+        {
+            is->disabel_hw = 1;
+        }
+        else if (strcmp("-hw_name", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                av_free(is->hw_name);
+                is->hw_name = av_strdup(argv[i + 1]);
+            }
+        }
+        else if (strcmp("-volume", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                volume = atoi(argv[i + 1]);
+            }
+        }
+        else if (strcmp("-audio_null", argv[i]) == 0)
+        {
+            is->audio_null = 1;
+        }
+        else if (strcmp("-audio_dump", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                /* a file or a pipe, e.g. pipe:1, only the null sink writes it */
+                av_free(is->audio_dump);
+                is->audio_dump = av_strdup(argv[i + 1]);
+                is->audio_null = 1;
+            }
+        }
+        else if (strcmp("-audio_shm", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                av_free(is->audio_shm_name);
+                is->audio_shm_name = av_strdup(argv[i + 1]);
+            }
+        }
+        else if (strcmp("-meter", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                /* reports per second, 0 turns the meters off */
+                is->meter_rate = av_clip(atoi(argv[i + 1]), 0, 100);
+            }
+        }
+        else if (strcmp("-meter_bands", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->meter_bands = av_clip(atoi(argv[i + 1]), 0, METER_MAX_BANDS);
+            }
+        }
+        else if (strcmp("-resample", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                int profile = resample_profile_parse(argv[i + 1]);
+
+                if (profile < 0)
+                    av_log(NULL, AV_LOG_WARNING, "Unknown resample profile %s, use fast, default or hq\n", argv[i + 1]);
+                else
+                    is->resample_profile = profile;
+            }
+        }
+        else if (strcmp("-audio_latency", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->audio_latency_offset = av_clip(atoi(argv[i + 1]), -1000, 1000);
+            }
+        }
+        else if (strcmp("-audio_tracks", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                /* stream indices mixed into the main audio, or all */
+                audio_mix_parse_streams(&is->audio_mix, argv[i + 1]);
+            }
+        }
+        else if (strcmp("-track_gains", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                /* percents, the main audio first, e.g. 100,0 starts with the second track muted */
+                audio_mix_parse_gains(&is->audio_mix, argv[i + 1]);
+            }
+        }
+        else if (strcmp("-noaudio_float", argv[i]) == 0)
+        {
+            is->audio_float = 0;
+        }
+        else if (strcmp("-audio_ring", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->audio_ring_ms = av_clip(atoi(argv[i + 1]), 20, 5000);
+            }
+        }
+        else if (strcmp("-reconnect", argv[i]) == 0)
+        {
+            is->reconnect = 1;
+        }
+        else if (strcmp("-noreconnect", argv[i]) == 0)
+        {
+            is->reconnect = 0;
+        }
+        else if (strcmp("-loop", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->loop = FFMAX(atoi(argv[i + 1]), 0);
+            }
+        }
+        else if (strcmp("-playlist", argv[i]) == 0)
+        {
+            is->playlist_file = 1;
+        }
+        else if (strcmp("-loop_cache", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->loop_cache_size = FFMAX(atoi(argv[i + 1]), 0) * (int64_t)(1024 * 1024);
+            }
+        }
+        else if (strcmp("-loop_cache_max", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->loop_cache_max = FFMAX(atof(argv[i + 1]), 0) * AV_TIME_BASE;
+            }
+        }
+        else if (strcmp("-step_cache", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->step_cache_size = FFMAX(atoi(argv[i + 1]), 0) * (int64_t)(1024 * 1024);
+            }
+        }
+        else if (strcmp("-accurate_seek", argv[i]) == 0)
+        {
+            is->accurate_seek = 1;
+        }
+        else if (strcmp("-noaccurate_seek", argv[i]) == 0)
+        {
+            is->accurate_seek = 0;
+        }
+        else if (strcmp("-index", argv[i]) == 0)
+        {
+            is->keyindex_mode = 1;
+        }
+        else if (strcmp("-noindex", argv[i]) == 0)
+        {
+            is->keyindex_mode = 0;
+        }
+        else if (strcmp("-index_dir", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                av_free(is->index_dir);
+                is->index_dir = av_strdup(argv[i + 1]);
+            }
+        }
+        else if (strcmp("-jitter", argv[i]) == 0)
+        {
+            is->jitter = 1;
+        }
+        else if (strcmp("-nojitter", argv[i]) == 0)
+        {
+            is->jitter = 0;
+        }
+        else if (strcmp("-jitter_min", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->jitter_min = FFMAX(atoi(argv[i + 1]), 0) * (int64_t)1000;
+            }
+        }
+        else if (strcmp("-jitter_max", argv[i]) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                is->jitter_max = FFMAX(atoi(argv[i + 1]), 0) * (int64_t)1000;
             }
-            SDL_LockMutex(wait_mutex);
-            SDL_CondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
-            SDL_UnlockMutex(wait_mutex);
-            eof = 1;
-            continue;
         }
-        else
+        else if (strcmp("-noadaptive_skip", argv[i]) == 0)
         {
-            is->eof = 0;
+            is->skip.enabled = 0;
         }
-        /* check if packet is in play range specified by user, then queue, otherwise discard */
-        stream_start_time = ic->streams[pkt->stream_index]->start_time;
-        pkt_ts = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
-        pkt_in_play_range = duration == AV_NOPTS_VALUE ||
-            (pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
-            av_q2d(ic->streams[pkt->stream_index]->time_base) -
-            (double)(start_time != AV_NOPTS_VALUE ? start_time : 0) / 1000000 <=
-            ((double)duration / 1000000);
-        if (pkt->stream_index == is->audio_stream && pkt_in_play_range)
+        else if (strcmp("-max_fps", argv[i]) == 0)
         {
-            packet_queue_put(&is->audioq, pkt);
+            if (i + 1 < argc)
+            {
+                is->max_fps = FFMAX(atof(argv[i + 1]), 0);
+            }
         }
-        else if (pkt->stream_index == is->video_stream && pkt_in_play_range && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        else if (strcmp("-speed", argv[i]) == 0)
         {
-            packet_queue_put(&is->videoq, pkt);
+            if (i + 1 < argc)
+            {
+                is->speed = av_clipd(atof(argv[i + 1]), SPEED_MIN, SPEED_MAX);
+            }
         }
-        else
+        else if (strcmp("-priority", argv[i]) == 0)
         {
-            av_packet_unref(pkt);
+            if (i + 1 < argc)
+            {
+                is->priority = parse_priority(argv[i + 1]);
+            }
         }
     }
 
-    ret = 0;
-fail:
-    if (ic && !is->ic)
-        avformat_close_input(&ic);
-
-    av_packet_free(&pkt);
-    if (ret != 0)
+    if (!is->disable_audio && !is->audio_null && !is->audio_shm_name && !SDL_WasInit(SDL_INIT_AUDIO))
     {
-        SDL_Event event;
+        /* Try to work around an occasional ALSA buffer underflow issue when the
+         * period size is NPOT due to ALSA resampling by forcing the buffer size. */
+        if (!SDL_getenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE"))
+            SDL_setenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE", "1", 1);
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO))
+        {
+            av_log(NULL, AV_LOG_WARNING, "Could not initialize SDL audio - %s, using the null sink\n", SDL_GetError());
+            is->audio_null = 1;
+        }
+    }
 
-        event.type = FF_QUIT_EVENT;
-        event.user.data1 = is;
-        SDL_PushEvent(&event);
+    av_log(NULL, AV_LOG_INFO, "Session %d input file: %s, max width: %d, max height: %d\n",
+        id, filename, max_width, max_height);
+
+    /* stream_open frees the state on failure */
+    if (!stream_open(filename, is, volume))
+    {
+        av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
+        return NULL;
     }
-    SDL_DestroyMutex(wait_mutex);
-    return 0;
+
+    sessions[nb_sessions++] = is;
+    return is;
 }
 
-static VideoState* stream_open(const char* filename, VideoState* is)
+/* payload is "url\0width\0height\0mem_name\0[options\0...]" */
+static void session_create_from_payload(int id, char* data, int size)
 {
-    is->last_video_stream = is->video_stream = -1;
-    is->last_audio_stream = is->audio_stream = -1;
-    is->filename = av_strdup(filename);
-    if (!is->filename)
-        goto fail;
+    char* argv[64];
+    int argc = 0;
+    char* p = data;
+    char* end = data + size;
 
-    /* start video display */
-    if (frame_queue_init(&is->pictq, &is->videoq, VIDEO_PICTURE_QUEUE_SIZE, 1) < 0)
-        goto fail;
-    if (frame_queue_init(&is->sampq, &is->audioq, SAMPLE_QUEUE_SIZE, 1) < 0)
-        goto fail;
-
-    if (packet_queue_init(&is->videoq) < 0 ||
-        packet_queue_init(&is->audioq) < 0)
-        goto fail;
-
-    if (!(is->continue_read_thread = SDL_CreateCond()))
+    while (p < end && argc < FF_ARRAY_ELEMS(argv))
     {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
-        goto fail;
+        argv[argc++] = p;
+        p += strlen(p) + 1;
     }
 
-    init_clock(&is->vidclk, &is->videoq.serial);
-    init_clock(&is->audclk, &is->audioq.serial);
-    init_clock(&is->extclk, &is->extclk.serial);
-    is->audio_clock_serial = -1;
-    if (startup_volume < 0)
-        av_log(NULL, AV_LOG_WARNING, "-volume=%d < 0, setting to 0\n", startup_volume);
-    if (startup_volume > 100)
-        av_log(NULL, AV_LOG_WARNING, "-volume=%d > 100, setting to 100\n", startup_volume);
-    startup_volume = av_clip(startup_volume, 0, 100);
-    startup_volume = av_clip(SDL_MIX_MAXVOLUME * startup_volume / 100, 0, SDL_MIX_MAXVOLUME);
-    is->audio_volume = startup_volume;
-    is->muted = 0;
-    is->av_sync_type = av_sync_type;
-    is->read_tid = SDL_CreateThread(read_thread, "read_thread", is);
-    if (!is->read_tid)
+    if (argc < 4)
     {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
-    fail:
-        stream_close(is);
-        return NULL;
+        av_log(NULL, AV_LOG_ERROR, "Session %d open command needs url, width, height and memory name\n", id);
+        return;
     }
-    return is;
+
+    session_create(id, argv[0], atoi(argv[1]), atoi(argv[2]), argv[3], argc - 4, argv + 4);
 }
 
-static void stream_cycle_channel(VideoState* is, int codec_type)
+static void session_close(VideoState* is)
 {
-    AVFormatContext* ic = is->ic;
-    int start_index, stream_index;
-    int old_index;
-    AVStream* st;
-    AVProgram* p = NULL;
-    int nb_streams = is->ic->nb_streams;
+    int i;
 
-    if (codec_type == AVMEDIA_TYPE_VIDEO)
+    for (i = 0; i < nb_sessions; i++)
     {
-        start_index = is->last_video_stream;
-        old_index = is->video_stream;
+        if (sessions[i] == is)
+            break;
     }
-    else if (codec_type == AVMEDIA_TYPE_AUDIO)
+    if (i == nb_sessions)
+        return;
+
+    memmove(&sessions[i], &sessions[i + 1], (nb_sessions - i - 1) * sizeof(*sessions));
+    nb_sessions--;
+
+    av_log(NULL, AV_LOG_INFO, "Close session %d\n", is->id);
+    stream_close(is);
+
+    if (!nb_sessions && !server_mode)
+        do_exit();
+}
+
+static void session_command(SessionCommand* command)
+{
+    VideoState* is;
+
+    switch (command->cmd)
     {
-        start_index = is->last_audio_stream;
-        old_index = is->audio_stream;
+    case SOCKET_CMD_SESSION_OPEN:
+        session_create_from_payload(command->session, (char*)command->data, command->size);
+        return;
+    case SOCKET_CMD_MOSAIC_LAYOUT:
+        mosaic_layout((char*)command->data, command->size);
+        return;
+    case SOCKET_CMD_MOSAIC_CLOSE:
+        mosaic_close();
+        return;
     }
-    stream_index = start_index;
 
-    if (codec_type != AVMEDIA_TYPE_VIDEO && is->video_stream != -1)
+    is = session_find(command->session);
+    if (!is)
     {
-        p = av_find_program_from_stream(ic, NULL, is->video_stream);
-        if (p)
-        {
-            nb_streams = p->nb_stream_indexes;
-            for (start_index = 0; start_index < nb_streams; start_index++)
-                if (p->stream_index[start_index] == stream_index)
-                    break;
-            if (start_index == nb_streams)
-                start_index = -1;
-            stream_index = start_index;
-        }
+        av_log(NULL, AV_LOG_WARNING, "Command 0x%02x for unknown session %d\n", command->cmd, command->session);
+        return;
     }
 
-    for (;;)
+    switch (command->cmd)
     {
-        if (++stream_index >= nb_streams)
-        {
-            if (start_index == -1)
-                return;
-            stream_index = 0;
-        }
-        if (stream_index == start_index)
-            return;
-        st = is->ic->streams[p ? p->stream_index[stream_index] : stream_index];
-        if (st->codecpar->codec_type == codec_type)
+    case SOCKET_CMD_START_SEND:
+        is->send_image = 1;
+        is->force_refresh = 1;
+        is->dirty_reset = 1;
+        break;
+    case SOCKET_CMD_VOLUME:
+        if (command->size >= 1)
+            is->audio_volume = av_clip(SDL_MIX_MAXVOLUME * command->data[0] / 100, 0, SDL_MIX_MAXVOLUME);
+        break;
+    case SOCKET_CMD_PRIORITY:
+        if (command->size >= 1)
         {
-            /* check that parameters are OK */
-            switch (codec_type)
-            {
-            case AVMEDIA_TYPE_AUDIO:
-                if (st->codecpar->sample_rate != 0 &&
-                    st->codecpar->ch_layout.nb_channels != 0)
-                    goto the_end;
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                goto the_end;
-            default:
-                break;
-            }
+            is->priority = av_clip(command->data[0], POOL_PRIORITY_LOW, POOL_PRIORITY_HIGH);
+            if (is->viddec.avctx)
+                is->viddec.priority = is->priority;
         }
-    }
-the_end:
-    if (p && stream_index != -1)
-        stream_index = p->stream_index[stream_index];
-    av_log(NULL, AV_LOG_INFO, "Switch %s stream from #%d to #%d\n",
-        av_get_media_type_string(codec_type),
-        old_index,
-        stream_index);
-
-    stream_component_close(is, old_index);
-    stream_component_open(is, stream_index);
-}
-
-static void refresh_loop_wait_event(VideoState* is, SDL_Event* event)
-{
-    double remaining_time = 0.0;
-    SDL_PumpEvents();
-    while (!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT))
-    {
-        if (!cursor_hidden && av_gettime_relative() - cursor_last_shown > CURSOR_HIDE_DELAY)
+        break;
+    case SOCKET_CMD_VISIBILITY:
+        if (command->size >= 1)
+            session_set_visible(is, command->data[0], command->size >= 2 && (command->data[1] & 1));
+        break;
+    case SOCKET_CMD_MAX_FPS:
+        if (command->size >= 2)
         {
-            SDL_ShowCursor(0);
-            cursor_hidden = 1;
+            is->max_fps = AV_RL16(command->data);
+            update_video_discard(is);
         }
-        if (remaining_time > 0.0)
-            av_usleep((int64_t)(remaining_time * 1000000.0));
-        remaining_time = REFRESH_RATE;
-        if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
-            video_refresh(is, &remaining_time);
-        SDL_PumpEvents();
-        if (need_exit)
+        break;
+    case SOCKET_CMD_SPEED:
+        if (command->size >= 2)
+            session_set_speed(is, AV_RL16(command->data) / 100.0);
+        break;
+    case SOCKET_CMD_STEP:
+        if (command->size >= 1)
         {
-            do_exit(is);
+            if ((int8_t)command->data[0] < 0)
+                step_to_prev_frame(is);
+            else
+                step_forward(is);
         }
+        break;
+    case SOCKET_CMD_PLAYLIST_ADD:
+        session_playlist_add(is, (char*)command->data, command->size);
+        break;
+    case SOCKET_CMD_AUDIO_LATENCY:
+        if (command->size >= 2)
+            is->audio_latency_offset = (int16_t)(command->data[0] | command->data[1] << 8);
+        break;
+    case SOCKET_CMD_TRACK_GAIN:
+        if (command->size >= 3)
+            audio_mix_set_gain(&is->audio_mix, command->data[0], AV_RL16(command->data + 1));
+        break;
+    case SOCKET_CMD_PAUSE:
+        if (command->size >= 1 && !!command->data[0] != is->paused)
+            toggle_pause(is);
+        is->force_refresh = 1;
+        break;
+    case SOCKET_CMD_SESSION_CLOSE:
+        session_close(is);
+        break;
+    default:
+        av_log(NULL, AV_LOG_WARNING, "Unknown command 0x%02x\n", command->cmd);
+        break;
     }
 }
 
 /* handle an event sent by the GUI */
-static void event_loop(VideoState* cur_stream)
+static void event_loop(void)
 {
     static SDL_Event event;
     static double incr, pos, frac;
 
+    VideoState* cur_stream;
     double x;
-    refresh_loop_wait_event(cur_stream, &event);
+    refresh_loop_wait_event(&event);
+
+    /* keyboard and mouse always drive the first session */
+    cur_stream = nb_sessions ? sessions[0] : NULL;
     switch (event.type)
     {
     case SDL_KEYDOWN:
         if (exit_on_keydown || event.key.keysym.sym == SDLK_ESCAPE || event.key.keysym.sym == SDLK_q)
         {
-            do_exit(cur_stream);
+            do_exit();
             break;
         }
         // If we don't yet have a window, skip all key events, because read_thread might still be initializing...
-        if (!cur_stream->width)
+        if (!cur_stream || !cur_stream->width)
             return;
         switch (event.key.keysym.sym)
         {
@@ -2048,7 +4018,7 @@ static void event_loop(VideoState* cur_stream)
         case SDLK_DOWN:
             incr = -60.0;
         do_seek:
-            if (seek_by_bytes)
+            if (cur_stream->seek_by_bytes)
             {
                 pos = -1;
                 if (pos < 0 && cur_stream->video_stream >= 0)
@@ -2082,9 +4052,11 @@ static void event_loop(VideoState* cur_stream)
     case SDL_MOUSEBUTTONDOWN:
         if (exit_on_mousedown)
         {
-            do_exit(cur_stream);
+            do_exit();
             break;
         }
+        if (!cur_stream || !cur_stream->width)
+            break;
         if (event.button.button == SDL_BUTTON_LEFT)
         {
             static int64_t last_mouse_left_click = 0;
@@ -2105,6 +4077,8 @@ static void event_loop(VideoState* cur_stream)
             cursor_hidden = 0;
         }
         cursor_last_shown = av_gettime_relative();
+        if (!cur_stream || !cur_stream->width)
+            break;
         if (event.type == SDL_MOUSEBUTTONDOWN)
         {
             if (event.button.button != SDL_BUTTON_RIGHT)
@@ -2117,7 +4091,7 @@ static void event_loop(VideoState* cur_stream)
                 break;
             x = event.motion.x;
         }
-        if (seek_by_bytes || cur_stream->ic->duration <= 0)
+        if (cur_stream->seek_by_bytes || cur_stream->ic->duration <= 0)
         {
             uint64_t size = avio_size(cur_stream->ic->pb);
             stream_seek(cur_stream, size * x / cur_stream->width, 0, 1);
@@ -2146,64 +4120,43 @@ static void event_loop(VideoState* cur_stream)
         }
         break;
     case SDL_QUIT:
+        do_exit();
+        break;
     case FF_QUIT_EVENT:
-        do_exit(cur_stream);
+    {
+        VideoState* is = session_find(event.user.code);
+        if (is && is == event.user.data1)
+            session_close(is);
+        break;
+    }
+    case FF_SWITCH_EVENT:
+    {
+        VideoState* is = session_find(event.user.code);
+        if (is && is == event.user.data1)
+            stream_switch_run(is);
+        break;
+    }
+    case FF_COMMAND_EVENT:
+    {
+        SessionCommand* command = event.user.data1;
+        session_command(command);
+        av_free(command);
         break;
+    }
     default:
         break;
     }
 }
 
-VideoState* ff_is;
-
 int ffclient(int argc, char** argv)
 {
-    VideoState* is;
-
-    is = av_mallocz(sizeof(VideoState));
-    if (!is)
-        return -1;
-
-    char* input_filename = argv[0];
-    is->mem_name = argv[4];
-
-    img_max_width = atoi(argv[1]);
-    img_max_height = atoi(argv[2]);
-
-    init_socket(argv[3]);
-
-    for (int i = 5; i < argc; i++)
+    if (argc < 5)
     {
-        if (strcmp("-disable_audio", argv[i]) == 0)
-        {
-            is->disable_audio = 1;
-        }
-        else if (strcmp("-nobuffer", argv[i]) == 0)
-        {
-            is->nobuffer = 1;
-        }
-        else if (strcmp("-hw_disable", argv[i]) == 0)
-        {
-            is->disabel_hw = 1;
-        }
-        else if (strcmp("-hw_name", argv[i]) == 0)
-        {
-            if (i + 1 < argc)
-            {
-                is->hw_name = argv[i + 1];
-            }
-        }
-        else if (strcmp("-volume", argv[i]) == 0)
-        {
-            if (i + 1 < argc)
-            {
-                is->audio_volume = atoi(argv[i + 1]);
-            }
-        }
+        av_log(NULL, AV_LOG_FATAL, "Usage: -input url max_width max_height socket mem_name [options]\n");
+        return 1;
     }
 
-    av_log(NULL, AV_LOG_INFO, "input file: %s, max width: %d, max height: %d\n",
-        input_filename, img_max_width, img_max_height);
+    char* input_filename = argv[0];
 
     // av_log_set_level(AV_LOG_DEBUG);
 
@@ -2216,16 +4169,8 @@ int ffclient(int argc, char** argv)
     signal(SIGINT, sigterm_handler);  /* Interrupt (ANSI).    */
     signal(SIGTERM, sigterm_handler); /* Termination (ANSI).  */
 
-    int flags = SDL_INIT_EVENTS | SDL_INIT_TIMER;
-    if (!is->disable_audio)
-    {
-        flags |= SDL_INIT_AUDIO;
-        /* Try to work around an occasional ALSA buffer underflow issue when the
-* period size is NPOT due to ALSA resampling by forcing the buffer size. */
-        if (!SDL_getenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE"))
-            SDL_setenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE", "1", 1);
-    }
-    if (SDL_Init(flags))
+    /* audio is brought up by the first session that needs it */
+    if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_TIMER))
     {
         av_log(NULL, AV_LOG_FATAL, "Could not initialize SDL - %s\n", SDL_GetError());
         av_log(NULL, AV_LOG_FATAL, "(Did you set the DISPLAY variable?)\n");
@@ -2235,11 +4180,47 @@ int ffclient(int argc, char** argv)
     SDL_EventState(SDL_SYSWMEVENT, SDL_IGNORE);
     SDL_EventState(SDL_USEREVENT, SDL_IGNORE);
 
-    ff_is = stream_open(input_filename, is);
-    if (!ff_is)
+    wake_mutex = SDL_CreateMutex();
+    wake_cond = SDL_CreateCond();
+    if (!wake_mutex || !wake_cond)
     {
-        av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
-        do_exit(NULL);
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    /* -core_budget is process wide, it sizes the pool shared by all sessions */
+    for (int i = 5; i < argc; i++)
+    {
+        if (strcmp("-core_budget", argv[i]) == 0 && i + 1 < argc)
+            core_budget = atoi(argv[i + 1]);
+        /* -resample_bench [in_rate out_rate channels] measures the profiles and exits */
+        else if (strcmp("-resample_bench", argv[i]) == 0)
+        {
+            int given = i + 3 < argc && av_isdigit(argv[i + 1][0]);
+            int in_rate = given ? atoi(argv[i + 1]) : 48000;
+            int out_rate = given ? atoi(argv[i + 2]) : 44100;
+            int channels = given ? atoi(argv[i + 3]) : 2;
+
+            resample_benchmark(FFMAX(in_rate, 1), FFMAX(out_rate, 1), av_clip(channels, 1, 64));
+            exit(0);
+        }
+    }
+    if (pool_init(core_budget) < 0 || mosaic_init() < 0)
+        exit(1);
+
+    init_socket(argv[3]);
+
+    /* an empty input keeps the process alive for sessions opened over the socket */
+    if (!input_filename[0])
+    {
+        server_mode = 1;
+        av_log(NULL, AV_LOG_INFO, "No input, wait for sessions from the control socket\n");
+        return 0;
+    }
+
+    if (!session_create(0, input_filename, atoi(argv[1]), atoi(argv[2]), argv[4], argc - 5, argv + 5))
+    {
+        do_exit();
         return 1;
     }
 
@@ -2248,10 +4229,42 @@ int ffclient(int argc, char** argv)
 
 void ffclient_loop()
 {
-    event_loop(ff_is);
+    event_loop();
+}
+
+/* called from the socket thread, the command is run on the main thread */
+void ffclient_command(int session, int cmd, uint8_t* data, int size)
+{
+    SessionCommand* command;
+    SDL_Event event;
+
+    /* keep one extra zero byte so string payloads are terminated */
+    command = av_mallocz(sizeof(*command) + size + 1);
+    if (!command)
+        return;
+
+    command->session = session;
+    command->cmd = cmd;
+    command->size = size;
+    command->data = (uint8_t*)(command + 1);
+    if (size)
+        memcpy(command->data, data, size);
+
+    event.type = FF_COMMAND_EVENT;
+    event.user.data1 = command;
+    if (SDL_PushEvent(&event) <= 0)
+        av_free(command);
+    else
+        ffclient_wakeup();
 }
 
-void set_volume(int volume)
+/* any thread, makes a sleeping main loop look at its events and sessions again */
+void ffclient_wakeup(void)
 {
-    ff_is->audio_volume = av_clip(SDL_MIX_MAXVOLUME * volume / 100, 0, SDL_MIX_MAXVOLUME);
-}
\ No newline at end of file
+    if (!wake_mutex)
+        return;
+    SDL_LockMutex(wake_mutex);
+    wake_pending = 1;
+    SDL_CondSignal(wake_cond);
+    SDL_UnlockMutex(wake_mutex);
+}
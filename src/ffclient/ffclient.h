@@ -1,8 +1,11 @@
 #ifndef FFCLIENT_H
 #define FFCLIENT_H
 
+#include <inttypes.h>
+
 int ffclient(int argc, char** argv);
 void ffclient_loop();
-void set_volume(int volume);
+void ffclient_command(int session, int cmd, uint8_t* data, int size);
+void ffclient_wakeup(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "gain.h"
+
+#include <string.h>
+
+#include <libavutil/common.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GAIN_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GAIN_NEON 1
+#endif
+
+/*
+ * volume
+ *
+ * the callback multiplies straight from the ring buffer into the output instead of
+ * clearing it and calling SDL_MixAudioFormat.
+ * At a steady volume whole blocks are multiplied with SSE2/NEON, a volume change or mute
+ * first runs a short linear ramp in scalar code.
+ * 16 bit samples use Q15 fixed point, float output is multiplied directly.
+ */
+static void gain_s16(int16_t *dst, const int16_t *src, int n, float gain)
+{
+    int g = FFMIN((int)lrintf(gain * 32768.0f), 32767);
+    int i = 0;
+
+#if GAIN_SSE2
+    __m128i vg = _mm_set1_epi16((int16_t)g);
+    __m128i round = _mm_set1_epi32(1 << 14);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_mullo_epi16(x, vg);
+        __m128i hi = _mm_mulhi_epi16(x, vg);
+        __m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), 15);
+        __m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), 15);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+#elif GAIN_NEON
+    for (; i + 8 <= n; i += 8)
+        vst1q_s16(dst + i, vqrdmulhq_n_s16(vld1q_s16(src + i), (int16_t)g));
+#endif
+
+    for (; i < n; i++)
+        dst[i] = (int16_t)((src[i] * g + (1 << 14)) >> 15);
+}
+
+static void gain_flt(float *dst, const float *src, int n, float gain)
+{
+    int i = 0;
+
+#if GAIN_SSE2
+    __m128 vg = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), vg));
+#elif GAIN_NEON
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vmulq_n_f32(vld1q_f32(src + i), gain));
+#endif
+
+    for (; i < n; i++)
+        dst[i] = src[i] * gain;
+}
+
+void gain_init(AudioGain *g, int sample_rate, float gain)
+{
+    memset(g, 0, sizeof(*g));
+    g->gain = g->target = gain;
+    g->ramp_frames = FFMAX(sample_rate * GAIN_RAMP_MS / 1000, 1);
+}
+
+/*
+ * dst and src do not overlap, fmt is AV_SAMPLE_FMT_S16 or AV_SAMPLE_FMT_FLT.
+ * Counted in samples, a call may end in the middle of a sample frame.
+ */
+void gain_apply(AudioGain *g, uint8_t *dst, const uint8_t *src, int nb_samples, int channels,
+    enum AVSampleFormat fmt, float target)
+{
+    int bps = av_get_bytes_per_sample(fmt);
+    int i;
+
+    if (target != g->target)
+    {
+        g->target = target;
+        g->ramp = g->ramp_frames;
+        g->step = (target - g->gain) / g->ramp;
+    }
+
+    /* the ramp is short, plain C is enough */
+    for (i = 0; i < nb_samples && g->ramp; i++)
+    {
+        if (fmt == AV_SAMPLE_FMT_FLT)
+            ((float *)dst)[i] = ((const float *)src)[i] * g->gain;
+        else
+            ((int16_t *)dst)[i] = (int16_t)lrintf(((const int16_t *)src)[i] * g->gain);
+        if (++g->channel >= channels)
+        {
+            g->channel = 0;
+            g->gain = --g->ramp ? g->gain + g->step : g->target;
+        }
+    }
+    dst += i * bps;
+    src += i * bps;
+    nb_samples -= i;
+
+    if (nb_samples <= 0)
+        return;
+    g->channel = (g->channel + nb_samples) % channels;
+    if (g->gain >= 1.0f)
+        memcpy(dst, src, nb_samples * bps);
+    else if (g->gain <= 0.0f)
+        memset(dst, 0, nb_samples * bps);
+    else if (fmt == AV_SAMPLE_FMT_FLT)
+        gain_flt((float *)dst, (const float *)src, nb_samples, g->gain);
+    else
+        gain_s16((int16_t *)dst, (const int16_t *)src, nb_samples, g->gain);
+}
@@ -0,0 +1,25 @@
+#ifndef FFCLIENT_GAIN_H
+#define FFCLIENT_GAIN_H
+
+#include <inttypes.h>
+
+#include <libavutil/samplefmt.h>
+
+/* volume and mute changes fade over this long instead of clicking */
+#define GAIN_RAMP_MS 10
+
+typedef struct AudioGain
+{
+    float gain;   /* applied to the next sample */
+    float target;
+    float step;   /* per sample frame while ramping */
+    int ramp;     /* sample frames left in the ramp */
+    int ramp_frames;
+    int channel;  /* position inside the current sample frame */
+} AudioGain;
+
+void gain_init(AudioGain *g, int sample_rate, float gain);
+void gain_apply(AudioGain *g, uint8_t *dst, const uint8_t *src, int nb_samples, int channels,
+    enum AVSampleFormat fmt, float target);
+
+#endif
@@ -0,0 +1,169 @@
+#include "gopcache.h"
+
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/log.h>
+
+/* a gap longer than this many frame durations means the neighbours are not adjacent */
+#define GOP_CACHE_MAX_GAP 1.5
+/* used when a frame has no duration */
+#define GOP_CACHE_DEFAULT_DURATION 0.5
+
+/*
+ * step back cache
+ *
+ * recently shown pictures are kept sorted by pts, stepping back one frame takes the one before
+ * instead of seeking and decoding the whole GOP again.
+ * Over the memory budget the end farthest from the newest picture is dropped.
+ */
+int gop_cache_init(GopCache *c, int64_t budget)
+{
+    memset(c, 0, sizeof(*c));
+    c->budget = FFMAX(budget, 0);
+    if (!c->budget)
+        return 0;
+    if (!(c->mutex = SDL_CreateMutex()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        c->budget = 0;
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/* must hold the mutex */
+static void gop_cache_remove(GopCache *c, int index)
+{
+    c->used -= c->frames[index].size;
+    av_frame_free(&c->frames[index].frame);
+    memmove(&c->frames[index], &c->frames[index + 1], (c->nb_frames - index - 1) * sizeof(*c->frames));
+    c->nb_frames--;
+}
+
+void gop_cache_clear(GopCache *c)
+{
+    if (!c->mutex)
+        return;
+    SDL_LockMutex(c->mutex);
+    while (c->nb_frames)
+        gop_cache_remove(c, c->nb_frames - 1);
+    SDL_UnlockMutex(c->mutex);
+}
+
+void gop_cache_free(GopCache *c)
+{
+    gop_cache_clear(c);
+    if (c->mutex)
+        SDL_DestroyMutex(c->mutex);
+    memset(c, 0, sizeof(*c));
+}
+
+static int64_t frame_size(const AVFrame *frame)
+{
+    int64_t size = 0;
+    int i;
+
+    for (i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    return size;
+}
+
+/* keeps a reference, hardware pictures are copied to system memory */
+int gop_cache_add(GopCache *c, AVFrame *frame, double pts, double duration)
+{
+    GopFrame gf;
+    int ret, i, pos;
+
+    if (!c->budget || isnan(pts))
+        return 0;
+
+    gf.frame = av_frame_alloc();
+    if (!gf.frame)
+        return AVERROR(ENOMEM);
+    if (frame->hw_frames_ctx)
+    {
+        ret = av_hwframe_transfer_data(gf.frame, frame, 0);
+        if (ret >= 0)
+            ret = av_frame_copy_props(gf.frame, frame);
+    }
+    else
+    {
+        ret = av_frame_ref(gf.frame, frame);
+    }
+    if (ret < 0)
+    {
+        av_frame_free(&gf.frame);
+        return ret;
+    }
+    gf.pts = pts;
+    gf.duration = duration > 0 ? duration : GOP_CACHE_DEFAULT_DURATION;
+    gf.size = frame_size(gf.frame);
+
+    SDL_LockMutex(c->mutex);
+    /* frames arrive in display order, so the insert point is nearly always the end */
+    for (pos = c->nb_frames; pos > 0 && c->frames[pos - 1].pts >= pts; pos--)
+        ;
+    if (pos < c->nb_frames && fabs(c->frames[pos].pts - pts) < gf.duration / 2)
+    {
+        /* decoded again after a seek, keep the old copy */
+        SDL_UnlockMutex(c->mutex);
+        av_frame_free(&gf.frame);
+        return 0;
+    }
+
+    memmove(&c->frames[pos + 1], &c->frames[pos], (c->nb_frames - pos) * sizeof(*c->frames));
+    c->frames[pos] = gf;
+    c->nb_frames++;
+    c->used += gf.size;
+
+    /* drop from whichever end is farther away from the new frame */
+    while (c->nb_frames > 1 && (c->used > c->budget || c->nb_frames >= GOP_CACHE_MAX_FRAMES))
+    {
+        i = pts - c->frames[0].pts > c->frames[c->nb_frames - 1].pts - pts ? 0 : c->nb_frames - 1;
+        gop_cache_remove(c, i);
+    }
+    SDL_UnlockMutex(c->mutex);
+    return 0;
+}
+
+/*
+ * the picture next to the one at pts, dir < 0 for the previous one.
+ * Returns 1 and a reference in dst, 0 when it is not cached.
+ */
+int gop_cache_step(GopCache *c, double pts, int dir, AVFrame *dst, double *dst_pts)
+{
+    const GopFrame *cur, *next;
+    int found = 0;
+    int i;
+
+    if (!c->budget || isnan(pts))
+        return 0;
+
+    SDL_LockMutex(c->mutex);
+    for (i = 0; i < c->nb_frames; i++)
+    {
+        cur = &c->frames[i];
+        if (fabs(cur->pts - pts) >= cur->duration / 2)
+            continue;
+
+        i += dir < 0 ? -1 : 1;
+        if (i < 0 || i >= c->nb_frames)
+            break;
+        next = &c->frames[i];
+        /* only a neighbour without a hole in between */
+        if (dir < 0 ? cur->pts - next->pts > next->duration * GOP_CACHE_MAX_GAP
+                    : next->pts - cur->pts > cur->duration * GOP_CACHE_MAX_GAP)
+            break;
+        if (av_frame_ref(dst, next->frame) >= 0)
+        {
+            *dst_pts = next->pts;
+            found = 1;
+        }
+        break;
+    }
+    SDL_UnlockMutex(c->mutex);
+    return found;
+}
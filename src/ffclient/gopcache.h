@@ -0,0 +1,40 @@
+#ifndef FFCLIENT_GOPCACHE_H
+#define FFCLIENT_GOPCACHE_H
+
+#include <inttypes.h>
+
+#include <libavutil/frame.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#define GOP_CACHE_MAX_FRAMES 1024
+
+typedef struct GopFrame
+{
+    AVFrame *frame;
+    double pts;
+    double duration;
+    int64_t size;
+} GopFrame;
+
+/* decoded pictures sorted by pts, bounded by a memory budget */
+typedef struct GopCache
+{
+    GopFrame frames[GOP_CACHE_MAX_FRAMES];
+    int nb_frames;
+    int64_t budget; /* bytes, 0 disables the cache */
+    int64_t used;
+    SDL_mutex *mutex;
+} GopCache;
+
+int gop_cache_init(GopCache *c, int64_t budget);
+void gop_cache_free(GopCache *c);
+void gop_cache_clear(GopCache *c);
+int gop_cache_add(GopCache *c, AVFrame *frame, double pts, double duration);
+int gop_cache_step(GopCache *c, double pts, int dir, AVFrame *dst, double *dst_pts);
+
+#endif
@@ -0,0 +1,212 @@
+#include "jitter.h"
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/time.h>
+
+/* the smallest transit is taken over two windows of this length, so clock drift is followed */
+#define JITTER_WINDOW 2000000
+/* a timestamp jump larger than this restarts the statistics of the stream */
+#define JITTER_RESET 10000000
+/* target delay is this many times the measured jitter */
+#define JITTER_FACTOR 4
+/* the delay grows at once but shrinks by 1/JITTER_SHRINK of the difference per packet */
+#define JITTER_SHRINK 256
+
+/*
+ * adaptive jitter buffer
+ *
+ * live packets from read_thread wait here, the arrival jitter is estimated as in RFC 3550,
+ * the target delay is jitter * JITTER_FACTOR, kept between min_delay and max_delay.
+ * The release thread puts each packet into its PacketQueue at its timestamp plus the delay.
+ */
+static int jitter_thread(void *arg)
+{
+    JitterBuffer *jb = arg;
+    JitterPacket jp;
+
+    SDL_LockMutex(jb->mutex);
+    for (;;)
+    {
+        int64_t now;
+
+        while (!jb->abort && !av_fifo_can_read(jb->list))
+            SDL_CondWait(jb->cond, jb->mutex);
+        if (jb->abort)
+            break;
+
+        av_fifo_peek(jb->list, &jp, 1, 0);
+        now = av_gettime_relative();
+        if (jp.release > now)
+        {
+            SDL_CondWaitTimeout(jb->cond, jb->mutex, (Uint32)FFMAX((jp.release - now + 999) / 1000, 1));
+            continue;
+        }
+
+        av_fifo_read(jb->list, &jp, 1);
+        jb->in_flight = 1;
+        SDL_UnlockMutex(jb->mutex);
+        packet_queue_put(jp.queue, jp.pkt);
+        av_packet_free(&jp.pkt);
+        SDL_LockMutex(jb->mutex);
+        jb->in_flight = 0;
+        SDL_CondBroadcast(jb->cond);
+    }
+    SDL_UnlockMutex(jb->mutex);
+
+    return 0;
+}
+
+int jitter_init(JitterBuffer *jb, int64_t min_delay, int64_t max_delay)
+{
+    memset(jb, 0, sizeof(*jb));
+    jb->min_delay = FFMAX(min_delay, 0);
+    jb->max_delay = FFMAX(max_delay, jb->min_delay);
+    jb->delay = jb->min_delay;
+
+    jb->list = av_fifo_alloc2(256, sizeof(JitterPacket), AV_FIFO_FLAG_AUTO_GROW);
+    if (!jb->list)
+        return AVERROR(ENOMEM);
+    if (!(jb->mutex = SDL_CreateMutex()) || !(jb->cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        jitter_destroy(jb);
+        return AVERROR(ENOMEM);
+    }
+    jb->tid = SDL_CreateThread(jitter_thread, "jitter", jb);
+    if (!jb->tid)
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        jitter_destroy(jb);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/* must hold the mutex */
+static void jitter_clear(JitterBuffer *jb)
+{
+    JitterPacket jp;
+
+    while (av_fifo_read(jb->list, &jp, 1) >= 0)
+        av_packet_free(&jp.pkt);
+    memset(jb->streams, 0, sizeof(jb->streams));
+    jb->last_release = 0;
+}
+
+void jitter_flush(JitterBuffer *jb)
+{
+    if (!jb->mutex)
+        return;
+    SDL_LockMutex(jb->mutex);
+    /* a packet already taken out must reach its queue before the caller flushes the queue */
+    while (jb->in_flight)
+        SDL_CondWait(jb->cond, jb->mutex);
+    jitter_clear(jb);
+    SDL_UnlockMutex(jb->mutex);
+}
+
+void jitter_destroy(JitterBuffer *jb)
+{
+    if (jb->tid)
+    {
+        SDL_LockMutex(jb->mutex);
+        jb->abort = 1;
+        SDL_CondBroadcast(jb->cond);
+        SDL_UnlockMutex(jb->mutex);
+        SDL_WaitThread(jb->tid, NULL);
+    }
+    if (jb->list)
+        jitter_clear(jb);
+    av_fifo_freep2(&jb->list);
+    if (jb->cond)
+        SDL_DestroyCond(jb->cond);
+    if (jb->mutex)
+        SDL_DestroyMutex(jb->mutex);
+    memset(jb, 0, sizeof(*jb));
+}
+
+/* must hold the mutex, returns when the packet should ideally leave */
+static int64_t jitter_schedule(JitterBuffer *jb, JitterStream *st, int64_t ts, int64_t now)
+{
+    int64_t transit = now - ts;
+    double target;
+    int i;
+
+    if (!st->init || FFABS(transit - st->base) > JITTER_RESET)
+    {
+        st->init = 1;
+        st->base = st->window_min = st->last_transit = transit;
+        st->window_start = now;
+        st->jitter = 0;
+    }
+
+    /* RFC 3550 section 6.4.1 */
+    st->jitter += (FFABS(transit - st->last_transit) - st->jitter) / 16.0;
+    st->last_transit = transit;
+
+    /* the fastest packet of the last two windows defines the path delay */
+    if (now - st->window_start > JITTER_WINDOW)
+    {
+        st->base = FFMIN(st->window_min, transit);
+        st->window_min = transit;
+        st->window_start = now;
+    }
+    st->window_min = FFMIN(st->window_min, transit);
+    st->base = FFMIN(st->base, transit);
+
+    target = 0;
+    for (i = 0; i < JITTER_MAX_STREAMS; i++)
+    {
+        if (jb->streams[i].init)
+            target = FFMAX(target, jb->streams[i].jitter * JITTER_FACTOR);
+    }
+    target = av_clipd(target, jb->min_delay, jb->max_delay);
+    if (target > jb->delay)
+        jb->delay = target;
+    else
+        jb->delay += (target - jb->delay) / JITTER_SHRINK;
+
+    return ts + st->base + (int64_t)jb->delay;
+}
+
+int jitter_put(JitterBuffer *jb, PacketQueue *q, AVPacket *pkt, AVRational time_base)
+{
+    JitterPacket jp;
+    int64_t now = av_gettime_relative();
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    int ret;
+
+    if (!jb->tid || pkt->stream_index < 0 || pkt->stream_index >= JITTER_MAX_STREAMS)
+        return packet_queue_put(q, pkt);
+
+    jp.pkt = av_packet_alloc();
+    if (!jp.pkt)
+    {
+        av_packet_unref(pkt);
+        return AVERROR(ENOMEM);
+    }
+    av_packet_move_ref(jp.pkt, pkt);
+    jp.queue = q;
+
+    SDL_LockMutex(jb->mutex);
+    if (ts != AV_NOPTS_VALUE)
+        jp.release = jitter_schedule(jb, &jb->streams[jp.pkt->stream_index],
+            av_rescale_q(ts, time_base, AV_TIME_BASE_Q), now);
+    else
+        jp.release = now;
+    /* keep the arrival order and never hold a packet longer than the maximum */
+    jp.release = av_clip64(jp.release, jb->last_release, now + jb->max_delay);
+    jb->last_release = jp.release;
+
+    ret = av_fifo_write(jb->list, &jp, 1);
+    if (ret >= 0)
+        SDL_CondBroadcast(jb->cond);
+    SDL_UnlockMutex(jb->mutex);
+
+    if (ret < 0)
+        av_packet_free(&jp.pkt);
+    return ret;
+}
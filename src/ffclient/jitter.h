@@ -0,0 +1,59 @@
+#ifndef FFCLIENT_JITTER_H
+#define FFCLIENT_JITTER_H
+
+#include <inttypes.h>
+
+#include <libavcodec/packet.h>
+#include <libavutil/fifo.h>
+#include <libavutil/rational.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#include "packet.h"
+
+#define JITTER_MAX_STREAMS 8
+
+typedef struct JitterPacket
+{
+    AVPacket *pkt;
+    PacketQueue *queue;
+    int64_t release; /* av_gettime_relative() when the packet may leave */
+} JitterPacket;
+
+/* arrival statistics of one stream, all in microseconds */
+typedef struct JitterStream
+{
+    int init;
+    int64_t base;        /* smallest transit (arrival - timestamp) seen recently */
+    int64_t window_min;
+    int64_t window_start;
+    int64_t last_transit;
+    double jitter;       /* RFC 3550 interarrival jitter */
+} JitterStream;
+
+/* holds live packets back just long enough to smooth out the network */
+typedef struct JitterBuffer
+{
+    AVFifo *list;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    SDL_Thread *tid;
+    int abort;
+    int in_flight; /* the release thread is putting a packet into its queue */
+    int64_t min_delay;
+    int64_t max_delay;
+    double delay;
+    int64_t last_release;
+    JitterStream streams[JITTER_MAX_STREAMS];
+} JitterBuffer;
+
+int jitter_init(JitterBuffer *jb, int64_t min_delay, int64_t max_delay);
+int jitter_put(JitterBuffer *jb, PacketQueue *q, AVPacket *pkt, AVRational time_base);
+void jitter_flush(JitterBuffer *jb);
+void jitter_destroy(JitterBuffer *jb);
+
+#endif
@@ -0,0 +1,323 @@
+#include "keyindex.h"
+#include "pool.h"
+
+#include <stdio.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+
+#define KEYINDEX_TAG MKTAG('F', 'K', 'I', 'X')
+#define KEYINDEX_VERSION 1
+/* packets read between two looks at the core budget */
+#define KEYINDEX_BATCH 256
+
+/*
+ * background keyframe index
+ *
+ * an input without a usable index (raw TS, MKV without cues, a file still being recorded) is read
+ * once from the start with its own AVFormatContext on a low priority thread, noting the pts
+ * and byte position of every keyframe.
+ * The table is saved in the cache directory under a hash of the url, a file that grew is
+ * indexed on from where the last run stopped.
+ * A seek jumps by bytes straight to the keyframe before the target.
+ */
+static uint64_t keyindex_hash(const char *s, int stream_id)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    /* FNV-1a */
+    for (; *s; s++)
+        h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+    return (h ^ (uint32_t)stream_id) * 0x100000001b3ULL;
+}
+
+static int keyindex_interrupt(void *arg)
+{
+    KeyIndex *ki = arg;
+
+    return ki->abort;
+}
+
+/* must hold the mutex */
+static int keyindex_add(KeyIndex *ki, int64_t ts, int64_t pos)
+{
+    if (ki->nb_entries && ts <= ki->entries[ki->nb_entries - 1].ts)
+        return 0;
+    if (ki->nb_entries == ki->capacity)
+    {
+        int capacity = ki->capacity ? ki->capacity * 2 : 1024;
+        KeyIndexEntry *entries = av_realloc_array(ki->entries, capacity, sizeof(*entries));
+
+        if (!entries)
+            return AVERROR(ENOMEM);
+        ki->entries = entries;
+        ki->capacity = capacity;
+    }
+    ki->entries[ki->nb_entries].ts = ts;
+    ki->entries[ki->nb_entries].pos = pos;
+    ki->nb_entries++;
+    return 0;
+}
+
+/* entries of an earlier run, kept when the file is the same or only grew */
+static void keyindex_load(KeyIndex *ki)
+{
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int complete, count, i;
+    AVRational tb;
+
+    if (!ki->path || avio_open(&pb, ki->path, AVIO_FLAG_READ) < 0)
+        return;
+
+    if (avio_rl32(pb) != KEYINDEX_TAG || avio_rl32(pb) != KEYINDEX_VERSION)
+        goto done;
+    size = avio_rl64(pb);
+    complete = avio_rl32(pb);
+    tb.num = avio_rl32(pb);
+    tb.den = avio_rl32(pb);
+    count = avio_rl32(pb);
+    if (size > ki->file_size || av_cmp_q(tb, ki->time_base) || count < 0)
+        goto done;
+
+    SDL_LockMutex(ki->mutex);
+    for (i = 0; i < count && !avio_feof(pb); i++)
+    {
+        int64_t ts = avio_rl64(pb);
+        int64_t pos = avio_rl64(pb);
+
+        if (keyindex_add(ki, ts, pos) < 0)
+            break;
+    }
+    ki->complete = complete && size == ki->file_size && i == count;
+    SDL_UnlockMutex(ki->mutex);
+
+    av_log(NULL, AV_LOG_VERBOSE, "Loaded %d keyframes of %s\n", ki->nb_entries, ki->url);
+done:
+    avio_closep(&pb);
+}
+
+static void keyindex_save(KeyIndex *ki)
+{
+    AVIOContext *pb = NULL;
+    char *tmp;
+    int i;
+
+    if (!ki->path || !ki->nb_entries)
+        return;
+
+    tmp = av_asprintf("%s.tmp", ki->path);
+    if (!tmp)
+        return;
+    if (avio_open(&pb, tmp, AVIO_FLAG_WRITE) < 0)
+    {
+        av_log(NULL, AV_LOG_WARNING, "Cannot write keyframe index %s\n", tmp);
+        av_free(tmp);
+        return;
+    }
+
+    SDL_LockMutex(ki->mutex);
+    avio_wl32(pb, KEYINDEX_TAG);
+    avio_wl32(pb, KEYINDEX_VERSION);
+    avio_wl64(pb, ki->file_size);
+    avio_wl32(pb, ki->complete);
+    avio_wl32(pb, ki->time_base.num);
+    avio_wl32(pb, ki->time_base.den);
+    avio_wl32(pb, ki->nb_entries);
+    for (i = 0; i < ki->nb_entries; i++)
+    {
+        avio_wl64(pb, ki->entries[i].ts);
+        avio_wl64(pb, ki->entries[i].pos);
+    }
+    SDL_UnlockMutex(ki->mutex);
+    avio_closep(&pb);
+
+    /* replace the old table in one step, a reader never sees half a file */
+    remove(ki->path);
+    if (rename(tmp, ki->path))
+        remove(tmp);
+    av_free(tmp);
+}
+
+static int keyindex_thread(void *arg)
+{
+    KeyIndex *ki = arg;
+    AVFormatContext *ic = NULL;
+    AVPacket *pkt = NULL;
+    int n = 0;
+    int ret;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    ic = avformat_alloc_context();
+    pkt = av_packet_alloc();
+    if (!ic || !pkt)
+        goto fail;
+    ic->interrupt_callback.callback = keyindex_interrupt;
+    ic->interrupt_callback.opaque = ki;
+    if (avformat_open_input(&ic, ki->url, NULL, NULL) < 0)
+        goto fail;
+
+    ki->file_size = ic->pb ? avio_size(ic->pb) : -1;
+    if (ki->file_size <= 0)
+        goto fail;
+    keyindex_load(ki);
+    if (ki->complete)
+        goto fail;
+
+    /* a recording that grew continues after the last known keyframe */
+    if (ki->nb_entries)
+        avformat_seek_file(ic, -1, INT64_MIN, ki->entries[ki->nb_entries - 1].pos, INT64_MAX, AVSEEK_FLAG_BYTE);
+
+    pool_slot_acquire(POOL_PRIORITY_LOW);
+    while (!ki->abort)
+    {
+        AVStream *st;
+
+        /* give the core back now and then, sessions always go first */
+        if (++n % KEYINDEX_BATCH == 0)
+        {
+            pool_slot_release(POOL_PRIORITY_LOW);
+            pool_slot_acquire(POOL_PRIORITY_LOW);
+        }
+
+        ret = av_read_frame(ic, pkt);
+        if (ret == AVERROR_EOF)
+        {
+            SDL_LockMutex(ki->mutex);
+            ki->complete = 1;
+            SDL_UnlockMutex(ki->mutex);
+            break;
+        }
+        if (ret < 0)
+        {
+            if (ic->pb && ic->pb->error)
+                break;
+            continue;
+        }
+
+        st = ic->streams[pkt->stream_index];
+        if (st->id == ki->stream_id && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0)
+        {
+            int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+
+            if (ts != AV_NOPTS_VALUE)
+            {
+                SDL_LockMutex(ki->mutex);
+                ret = keyindex_add(ki, av_rescale_q(ts, st->time_base, ki->time_base), pkt->pos);
+                SDL_UnlockMutex(ki->mutex);
+                if (ret < 0)
+                {
+                    av_packet_unref(pkt);
+                    break;
+                }
+            }
+        }
+        else if (st->id != ki->stream_id)
+        {
+            /* the demuxer can skip streams nobody asks for */
+            st->discard = AVDISCARD_ALL;
+        }
+        av_packet_unref(pkt);
+    }
+    pool_slot_release(POOL_PRIORITY_LOW);
+
+    av_log(NULL, AV_LOG_VERBOSE, "Indexed %d keyframes of %s%s\n", ki->nb_entries, ki->url,
+        ki->complete ? "" : " (partial)");
+    keyindex_save(ki);
+
+fail:
+    av_packet_free(&pkt);
+    avformat_close_input(&ic);
+    return 0;
+}
+
+int keyindex_start(KeyIndex *ki, const char *url, const char *dir, int stream_id, AVRational time_base)
+{
+    char *pref = NULL;
+
+    memset(ki, 0, sizeof(*ki));
+    ki->stream_id = stream_id;
+    ki->time_base = time_base;
+    ki->url = av_strdup(url);
+    if (!ki->url)
+        goto fail;
+
+    /* without a directory the table lives in the per user data folder */
+    if (!dir)
+        dir = pref = SDL_GetPrefPath("ffclient", "keyindex");
+    if (dir)
+        ki->path = av_asprintf("%s%s%016" PRIx64 ".kidx", dir,
+            dir[0] && !strchr("/\\", dir[strlen(dir) - 1]) ? "/" : "",
+            keyindex_hash(url, stream_id));
+    if (pref)
+        SDL_free(pref);
+
+    if (!(ki->mutex = SDL_CreateMutex()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        goto fail;
+    }
+    ki->tid = SDL_CreateThread(keyindex_thread, "keyindex", ki);
+    if (!ki->tid)
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        goto fail;
+    }
+    return 0;
+fail:
+    keyindex_stop(ki);
+    return AVERROR(ENOMEM);
+}
+
+void keyindex_stop(KeyIndex *ki)
+{
+    if (ki->tid)
+    {
+        ki->abort = 1;
+        SDL_WaitThread(ki->tid, NULL);
+    }
+    if (ki->mutex)
+        SDL_DestroyMutex(ki->mutex);
+    av_freep(&ki->entries);
+    av_freep(&ki->url);
+    av_freep(&ki->path);
+    memset(ki, 0, sizeof(*ki));
+}
+
+/*
+ * the last keyframe at or before ts, 0 when the table does not reach ts yet
+ * and the demuxer has to seek on its own
+ */
+int keyindex_lookup(KeyIndex *ki, int64_t ts, KeyIndexEntry *entry)
+{
+    int lo, hi, found = 0;
+
+    if (!ki->mutex)
+        return 0;
+
+    SDL_LockMutex(ki->mutex);
+    if (ki->nb_entries && ts >= ki->entries[0].ts &&
+        (ki->complete || ts <= ki->entries[ki->nb_entries - 1].ts))
+    {
+        lo = 0;
+        hi = ki->nb_entries - 1;
+        while (lo < hi)
+        {
+            int mid = (lo + hi + 1) / 2;
+
+            if (ki->entries[mid].ts <= ts)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        *entry = ki->entries[lo];
+        found = 1;
+    }
+    SDL_UnlockMutex(ki->mutex);
+    return found;
+}
@@ -0,0 +1,43 @@
+#ifndef FFCLIENT_KEYINDEX_H
+#define FFCLIENT_KEYINDEX_H
+
+#include <inttypes.h>
+
+#include <libavutil/rational.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+typedef struct KeyIndexEntry
+{
+    int64_t ts;  /* stream time base */
+    int64_t pos; /* byte offset of the packet */
+} KeyIndexEntry;
+
+/* keyframe table built by a low priority thread and cached on disk */
+typedef struct KeyIndex
+{
+    char *url;
+    char *path; /* cache file */
+    int stream_id;
+    AVRational time_base;
+    int64_t file_size;
+
+    KeyIndexEntry *entries;
+    int nb_entries;
+    int capacity;
+    int complete; /* the whole file is covered */
+
+    SDL_mutex *mutex;
+    SDL_Thread *tid;
+    int abort;
+} KeyIndex;
+
+int keyindex_start(KeyIndex *ki, const char *url, const char *dir, int stream_id, AVRational time_base);
+void keyindex_stop(KeyIndex *ki);
+int keyindex_lookup(KeyIndex *ki, int64_t ts, KeyIndexEntry *entry);
+
+#endif
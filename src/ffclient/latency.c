@@ -0,0 +1,92 @@
+#include "latency.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/log.h>
+#include <libavutil/mathematics.h>
+
+/* a callback this early after the previous one is the device filling up */
+#define LATENCY_PREFILL_RATIO 0.5
+/* loop bandwidth in Hz, low enough to average out the scheduler */
+#define LATENCY_DLL_BANDWIDTH 0.5
+/* further off than this many periods, the device was stopped or starved: start over */
+#define LATENCY_RESYNC_PERIODS 4
+
+/*
+ * audio output latency
+ *
+ * a device that starts playing calls back several times in a row to fill its buffer,
+ * and only then at the real time pace.
+ * The bytes handed over by that burst are the depth of the device buffer, instead of
+ * assuming SDL uses two periods.
+ * After that a second order DLL follows the callback times, a late callback means less is left
+ * in the device. The audio clock is updated from the filtered time,
+ * so scheduling jitter does not get into the clock.
+ * The fixed delay of Bluetooth or HDMI behind the device cannot be measured,
+ * -audio_latency or the host adds it.
+ */
+void latency_init(AudioLatency *l, int bytes_per_sec)
+{
+    memset(l, 0, sizeof(*l));
+    l->bytes_per_sec = bytes_per_sec;
+    l->prefill = 1;
+}
+
+static void latency_resync(AudioLatency *l, double now, double period)
+{
+    l->expect = now + period;
+    l->period = period;
+}
+
+double latency_update(AudioLatency *l, double now, int len, double *time)
+{
+    double period = (double)len / l->bytes_per_sec;
+    double err;
+
+    *time = now;
+    if (l->prefill)
+    {
+        if (!l->periods || now - l->last < period * LATENCY_PREFILL_RATIO)
+        {
+            l->depth += len;
+            l->periods++;
+            l->last = now;
+            return (double)l->depth / l->bytes_per_sec;
+        }
+
+        /* the first callback at the real time pace */
+        l->prefill = 0;
+        if (l->periods < 2)
+        {
+            /* nothing to see, the driver takes one period at a time: the old assumption */
+            l->depth = 2 * (int64_t)len;
+            l->periods = 2;
+        }
+        av_log(NULL, AV_LOG_INFO, "Audio output latency %.1f ms (%d periods of %.1f ms)\n",
+            l->depth * 1000.0 / l->bytes_per_sec, l->periods, period * 1000);
+        latency_resync(l, now, period);
+        l->last = now;
+        return (double)l->depth / l->bytes_per_sec;
+    }
+
+    err = now - l->expect;
+    l->last = now;
+    if (fabs(err) > LATENCY_RESYNC_PERIODS * period)
+    {
+        /* paused, starved or the machine slept */
+        latency_resync(l, now, period);
+    }
+    else
+    {
+        double omega = 2 * M_PI * LATENCY_DLL_BANDWIDTH * l->period;
+
+        *time = l->expect;
+        l->expect += l->period + M_SQRT2 * omega * err;
+        l->period += omega * omega * err;
+    }
+
+    /* the callback size may change, the device keeps the same depth */
+    return (double)l->depth / l->bytes_per_sec;
+}
@@ -0,0 +1,29 @@
+#ifndef FFCLIENT_LATENCY_H
+#define FFCLIENT_LATENCY_H
+
+#include <inttypes.h>
+
+/*
+ * how long the samples of an audio callback take to reach the speaker,
+ * measured from the callback timing instead of assuming two periods
+ */
+typedef struct AudioLatency
+{
+    int bytes_per_sec;
+    int prefill;      /* still counting the callbacks that fill the device at start */
+    int64_t depth;    /* bytes the device buffers ahead */
+    int periods;      /* depth in callbacks, for the log */
+    double last;      /* seconds, time of the previous callback */
+    /* delay locked loop on the callback times, removes the scheduling jitter */
+    double expect;    /* when the next callback is due */
+    double period;    /* filtered callback interval */
+} AudioLatency;
+
+void latency_init(AudioLatency *l, int bytes_per_sec);
+/*
+ * called at the start of every callback with its size, returns the latency
+ * in seconds of the end of the new data, *time is the filtered callback time
+ */
+double latency_update(AudioLatency *l, double now, int len, double *time);
+
+#endif
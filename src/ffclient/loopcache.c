@@ -0,0 +1,242 @@
+#include "loopcache.h"
+
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+
+/*
+ * loop cache for short clips
+ *
+ * the first pass keeps the demuxed packets in memory, every later pass sends them from memory
+ * without seeking, reading or demuxing. When the converted pictures fit as well, video also
+ * skips decoding and conversion.
+ * Over the memory budget or the duration limit the cache gives up and the file loops as usual.
+ */
+int loop_cache_init(LoopCache *lc, int64_t budget, int64_t max_duration)
+{
+    memset(lc, 0, sizeof(*lc));
+    if (budget <= 0)
+        return 0;
+    if (!(lc->mutex = SDL_CreateMutex()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    lc->budget = budget;
+    lc->max_duration = max_duration;
+    lc->start = AV_NOPTS_VALUE;
+    lc->state = LOOP_CACHE_RECORDING;
+    lc->pictures_state = LOOP_CACHE_RECORDING;
+    return 0;
+}
+
+static void free_packets(LoopCache *lc)
+{
+    int i;
+
+    for (i = 0; i < lc->nb_packets; i++)
+    {
+        lc->used -= lc->packets[i]->size;
+        av_packet_free(&lc->packets[i]);
+    }
+    av_freep(&lc->packets);
+    lc->nb_packets = lc->capacity = lc->cursor = 0;
+}
+
+void loop_cache_drop_pictures(LoopCache *lc)
+{
+    int i;
+
+    if (!lc->mutex)
+        return;
+    SDL_LockMutex(lc->mutex);
+    for (i = 0; i < lc->nb_pictures; i++)
+        av_frame_free(&lc->pictures[i].frame);
+    lc->pictures_used = 0;
+    av_freep(&lc->pictures);
+    lc->nb_pictures = lc->pictures_capacity = 0;
+    lc->pictures_state = LOOP_CACHE_OFF;
+    SDL_UnlockMutex(lc->mutex);
+}
+
+void loop_cache_abort(LoopCache *lc)
+{
+    if (lc->state != LOOP_CACHE_OFF)
+        av_log(NULL, AV_LOG_VERBOSE, "Loop cache given up\n");
+    loop_cache_drop_pictures(lc);
+    free_packets(lc);
+    lc->state = LOOP_CACHE_OFF;
+}
+
+void loop_cache_free(LoopCache *lc)
+{
+    loop_cache_abort(lc);
+    if (lc->mutex)
+        SDL_DestroyMutex(lc->mutex);
+    memset(lc, 0, sizeof(*lc));
+}
+
+/* the first pass reached its end, the next ones come from memory */
+void loop_cache_finish(LoopCache *lc)
+{
+    if (lc->state != LOOP_CACHE_RECORDING)
+        return;
+    if (!lc->nb_packets)
+    {
+        loop_cache_abort(lc);
+        return;
+    }
+    lc->state = LOOP_CACHE_READY;
+
+    SDL_LockMutex(lc->mutex);
+    if (lc->pictures_state == LOOP_CACHE_RECORDING)
+        lc->pictures_state = lc->nb_pictures ? LOOP_CACHE_READY : LOOP_CACHE_OFF;
+    SDL_UnlockMutex(lc->mutex);
+
+    av_log(NULL, AV_LOG_INFO, "Loop cache holds %d packets and %d pictures, %" PRId64 " KB\n",
+        lc->nb_packets, lc->pictures_state == LOOP_CACHE_READY ? lc->nb_pictures : 0, (lc->used + lc->pictures_used) / 1024);
+}
+
+int loop_cache_add_packet(LoopCache *lc, const AVPacket *pkt, AVRational time_base)
+{
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    AVPacket *copy;
+
+    if (lc->state != LOOP_CACHE_RECORDING)
+        return 0;
+
+    if (ts != AV_NOPTS_VALUE)
+    {
+        ts = av_rescale_q(ts, time_base, AV_TIME_BASE_Q);
+        if (lc->start == AV_NOPTS_VALUE)
+            lc->start = ts;
+        if (ts - lc->start > lc->max_duration)
+        {
+            loop_cache_abort(lc);
+            return 0;
+        }
+    }
+    if (lc->used + lc->pictures_used + pkt->size > lc->budget)
+    {
+        loop_cache_abort(lc);
+        return 0;
+    }
+
+    if (lc->nb_packets == lc->capacity)
+    {
+        int capacity = lc->capacity ? lc->capacity * 2 : 1024;
+        AVPacket **packets = av_realloc_array(lc->packets, capacity, sizeof(*packets));
+
+        if (!packets)
+        {
+            loop_cache_abort(lc);
+            return AVERROR(ENOMEM);
+        }
+        lc->packets = packets;
+        lc->capacity = capacity;
+    }
+    copy = av_packet_clone(pkt);
+    if (!copy)
+    {
+        loop_cache_abort(lc);
+        return AVERROR(ENOMEM);
+    }
+    lc->packets[lc->nb_packets++] = copy;
+    lc->used += copy->size;
+    return 0;
+}
+
+/* 0 at the end of the pass */
+int loop_cache_next_packet(LoopCache *lc, AVPacket *pkt)
+{
+    if (lc->state != LOOP_CACHE_READY || lc->cursor >= lc->nb_packets)
+        return 0;
+    return av_packet_ref(pkt, lc->packets[lc->cursor++]) < 0 ? 0 : 1;
+}
+
+void loop_cache_rewind(LoopCache *lc)
+{
+    lc->cursor = 0;
+}
+
+/* keeps a copy of the converted picture, drops them all once they no longer fit */
+int loop_cache_add_picture(LoopCache *lc, const AVFrame *frame, double pts)
+{
+    AVFrame *copy;
+    int64_t size = (int64_t)frame->width * frame->height * 4;
+    int ret = 0;
+
+    if (!lc->mutex)
+        return 0;
+
+    SDL_LockMutex(lc->mutex);
+    if (lc->pictures_state != LOOP_CACHE_RECORDING || isnan(pts))
+        goto end;
+    if (lc->used + lc->pictures_used + size > lc->budget)
+    {
+        SDL_UnlockMutex(lc->mutex);
+        loop_cache_drop_pictures(lc);
+        return 0;
+    }
+    if (lc->nb_pictures == lc->pictures_capacity)
+    {
+        int capacity = lc->pictures_capacity ? lc->pictures_capacity * 2 : 256;
+        LoopPicture *pictures = av_realloc_array(lc->pictures, capacity, sizeof(*pictures));
+
+        if (!pictures)
+        {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        lc->pictures = pictures;
+        lc->pictures_capacity = capacity;
+    }
+
+    copy = av_frame_alloc();
+    if (!copy)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    copy->format = frame->format;
+    copy->width = frame->width;
+    copy->height = frame->height;
+    if ((ret = av_frame_get_buffer(copy, 1)) < 0 || (ret = av_frame_copy(copy, frame)) < 0)
+    {
+        av_frame_free(&copy);
+        goto end;
+    }
+    copy->sample_aspect_ratio = (AVRational){ 1, 1 };
+    lc->pictures[lc->nb_pictures].frame = copy;
+    lc->pictures[lc->nb_pictures].pts = pts;
+    lc->nb_pictures++;
+    lc->pictures_used += size;
+end:
+    SDL_UnlockMutex(lc->mutex);
+    return ret;
+}
+
+/* 0 past the last picture */
+int loop_cache_picture(LoopCache *lc, int index, AVFrame *frame, double *pts, double *duration)
+{
+    int found = 0;
+
+    if (!lc->mutex)
+        return 0;
+
+    SDL_LockMutex(lc->mutex);
+    if (lc->pictures_state == LOOP_CACHE_READY && index < lc->nb_pictures &&
+        av_frame_ref(frame, lc->pictures[index].frame) >= 0)
+    {
+        *pts = lc->pictures[index].pts;
+        *duration = index + 1 < lc->nb_pictures ? lc->pictures[index + 1].pts - *pts :
+            index > 0 ? *pts - lc->pictures[index - 1].pts : 0;
+        found = 1;
+    }
+    SDL_UnlockMutex(lc->mutex);
+    return found;
+}
@@ -0,0 +1,64 @@
+#ifndef FFCLIENT_LOOPCACHE_H
+#define FFCLIENT_LOOPCACHE_H
+
+#include <inttypes.h>
+
+#include <libavcodec/packet.h>
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+enum LoopCacheState
+{
+    LOOP_CACHE_OFF,
+    LOOP_CACHE_RECORDING,
+    LOOP_CACHE_READY,
+};
+
+typedef struct LoopPicture
+{
+    AVFrame *frame; /* converted BGRA picture */
+    double pts;
+} LoopPicture;
+
+/* the first pass of a short looping clip, replayed from memory afterwards */
+typedef struct LoopCache
+{
+    int64_t budget;       /* bytes */
+    int64_t max_duration; /* AV_TIME_BASE */
+    int64_t used;         /* by packets */
+
+    /* demuxed packets, only touched by the read thread */
+    int state;
+    AVPacket **packets;
+    int nb_packets;
+    int capacity;
+    int cursor;
+    int64_t start;
+
+    /* converted pictures, written by the pool and read by the video thread */
+    int pictures_state;
+    LoopPicture *pictures;
+    int nb_pictures;
+    int pictures_capacity;
+    int64_t pictures_used;
+    SDL_mutex *mutex;
+} LoopCache;
+
+int loop_cache_init(LoopCache *lc, int64_t budget, int64_t max_duration);
+void loop_cache_free(LoopCache *lc);
+void loop_cache_abort(LoopCache *lc);
+void loop_cache_finish(LoopCache *lc);
+int loop_cache_add_packet(LoopCache *lc, const AVPacket *pkt, AVRational time_base);
+int loop_cache_next_packet(LoopCache *lc, AVPacket *pkt);
+void loop_cache_rewind(LoopCache *lc);
+int loop_cache_add_picture(LoopCache *lc, const AVFrame *frame, double pts);
+void loop_cache_drop_pictures(LoopCache *lc);
+int loop_cache_picture(LoopCache *lc, int index, AVFrame *frame, double *pts, double *duration);
+
+#endif
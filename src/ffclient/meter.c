@@ -0,0 +1,265 @@
+#include "meter.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define METER_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define METER_NEON 1
+#endif
+
+/*
+ * level meter and spectrum
+ *
+ * the conversion thread also measures the RMS and peak of every channel and reports them to
+ * the host at the configured rate,
+ * so a monitoring view does not decode the audio again. The optional coarse spectrum is one RDFT
+ * over the last METER_FFT_SIZE mono samples, merged into logarithmic bands.
+ * Interleaved samples are summed with SSE2/NEON in groups of lcm(4, channels), so every lane
+ * always belongs to the same channel.
+ */
+static void meter_levels(AudioMeter *m, const float *p, int n)
+{
+    int c = m->stride;
+    /* vectors per group, the group is lcm(4, c) samples of whole sample frames */
+    int k = c / (c & 3 ? (c & 1 ? 1 : 2) : 4);
+    int i = 0, j;
+
+#if METER_SSE2 || METER_NEON
+    if (k <= METER_MAX_CHANNELS && n >= 4 * k)
+    {
+        float sum[4 * METER_MAX_CHANNELS], peak[4 * METER_MAX_CHANNELS];
+#if METER_SSE2
+        __m128 vs[METER_MAX_CHANNELS], vp[METER_MAX_CHANNELS];
+        __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        for (j = 0; j < k; j++)
+            vs[j] = vp[j] = _mm_setzero_ps();
+        for (; i + 4 * k <= n; i += 4 * k)
+        {
+            for (j = 0; j < k; j++)
+            {
+                __m128 x = _mm_loadu_ps(p + i + 4 * j);
+                vs[j] = _mm_add_ps(vs[j], _mm_mul_ps(x, x));
+                vp[j] = _mm_max_ps(vp[j], _mm_and_ps(x, abs_mask));
+            }
+        }
+        for (j = 0; j < k; j++)
+        {
+            _mm_storeu_ps(sum + 4 * j, vs[j]);
+            _mm_storeu_ps(peak + 4 * j, vp[j]);
+        }
+#else
+        float32x4_t vs[METER_MAX_CHANNELS], vp[METER_MAX_CHANNELS];
+
+        for (j = 0; j < k; j++)
+            vs[j] = vp[j] = vdupq_n_f32(0);
+        for (; i + 4 * k <= n; i += 4 * k)
+        {
+            for (j = 0; j < k; j++)
+            {
+                float32x4_t x = vld1q_f32(p + i + 4 * j);
+                vs[j] = vmlaq_f32(vs[j], x, x);
+                vp[j] = vmaxq_f32(vp[j], vabsq_f32(x));
+            }
+        }
+        for (j = 0; j < k; j++)
+        {
+            vst1q_f32(sum + 4 * j, vs[j]);
+            vst1q_f32(peak + 4 * j, vp[j]);
+        }
+#endif
+        for (j = 0; j < 4 * k; j++)
+        {
+            int ch = j % c;
+
+            if (ch < m->channels)
+            {
+                m->sum[ch] += sum[j];
+                m->peak[ch] = FFMAX(m->peak[ch], peak[j]);
+            }
+        }
+    }
+#endif
+
+    /* i is a whole number of sample frames here */
+    for (; i < n; i++)
+    {
+        int ch = i % c;
+
+        if (ch < m->channels)
+        {
+            m->sum[ch] += p[i] * p[i];
+            m->peak[ch] = FFMAX(m->peak[ch], fabsf(p[i]));
+        }
+    }
+
+    if (m->nb_bands)
+    {
+        for (i = 0; i + c <= n; i += c)
+        {
+            float mono = 0;
+
+            for (j = 0; j < c; j++)
+                mono += p[i + j];
+            m->history[m->history_pos] = mono / c;
+            m->history_pos = (m->history_pos + 1) & (METER_FFT_SIZE - 1);
+        }
+    }
+}
+
+static int16_t meter_db(double power)
+{
+    double db = power > 1e-10 ? 10 * log10(power) : -100;
+
+    return (int16_t)lrint(av_clipd(db, -100, 20) * 100);
+}
+
+static void meter_report(AudioMeter *m)
+{
+    uint8_t buf[METER_REPORT_SIZE(METER_MAX_CHANNELS, METER_MAX_BANDS)];
+    uint8_t *p = buf;
+    int i, j;
+
+    *p++ = m->channels;
+    *p++ = m->nb_bands;
+    for (i = 0; i < m->channels; i++)
+    {
+        AV_WL16(p, meter_db(m->sum[i] / FFMAX(m->frames, 1)));
+        AV_WL16(p + 2, meter_db((double)m->peak[i] * m->peak[i]));
+        p += 4;
+        m->sum[i] = 0;
+        m->peak[i] = 0;
+    }
+
+    if (m->nb_bands)
+    {
+        /* a full scale sine reads about 0 dB, the Hann window gain is 1/2 */
+        double scale = 16.0 / ((double)METER_FFT_SIZE * METER_FFT_SIZE);
+
+        for (i = 0; i < METER_FFT_SIZE; i++)
+            m->fft_in[i] = m->history[(m->history_pos + i) & (METER_FFT_SIZE - 1)] * m->window[i];
+        m->tx_fn(m->tx, m->fft_out, m->fft_in, sizeof(float));
+
+        for (i = 0; i < m->nb_bands; i++)
+        {
+            double power = 0;
+
+            for (j = m->band_start[i]; j < m->band_start[i + 1]; j++)
+                power += (double)m->fft_out[j].re * m->fft_out[j].re + (double)m->fft_out[j].im * m->fft_out[j].im;
+            AV_WL16(p, meter_db(power * scale));
+            p += 2;
+        }
+    }
+
+    m->frames = 0;
+    m->report(m->opaque, buf, p - buf);
+}
+
+int meter_init(AudioMeter *m, int sample_rate, int channels, int rate, int bands,
+    void (*report)(void *opaque, const uint8_t *data, int size), void *opaque)
+{
+    float scale = 1.0f;
+    int i, ret;
+
+    memset(m, 0, sizeof(*m));
+    if (sample_rate <= 0 || channels <= 0 || rate <= 0)
+        return AVERROR(EINVAL);
+    m->channels = FFMIN(channels, METER_MAX_CHANNELS);
+    m->stride = channels;
+    m->sample_rate = sample_rate;
+    m->interval = FFMAX(sample_rate / rate, 1);
+    m->report = report;
+    m->opaque = opaque;
+
+    m->nb_bands = av_clip(bands, 0, METER_MAX_BANDS);
+    if (!m->nb_bands)
+        return 0;
+
+    m->window = av_malloc_array(METER_FFT_SIZE, sizeof(*m->window));
+    m->fft_in = av_malloc_array(METER_FFT_SIZE, sizeof(*m->fft_in));
+    m->fft_out = av_malloc_array(METER_FFT_SIZE / 2 + 1, sizeof(*m->fft_out));
+    if (!m->window || !m->fft_in || !m->fft_out)
+    {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = av_tx_init(&m->tx, &m->tx_fn, AV_TX_FLOAT_RDFT, 0, METER_FFT_SIZE, &scale, 0)) < 0)
+        goto fail;
+
+    for (i = 0; i < METER_FFT_SIZE; i++)
+        m->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / METER_FFT_SIZE);
+
+    /* log spaced, every band gets at least one bin */
+    for (i = 0; i <= m->nb_bands; i++)
+    {
+        double hz = METER_LOW_HZ * pow(sample_rate / 2.0 / METER_LOW_HZ, (double)i / m->nb_bands);
+        int bin = (int)lrint(hz * METER_FFT_SIZE / sample_rate);
+
+        if (i)
+            bin = FFMAX(bin, m->band_start[i - 1] + 1);
+        m->band_start[i] = FFMIN(bin, METER_FFT_SIZE / 2 + 1);
+    }
+    return 0;
+
+fail:
+    meter_free(m);
+    return ret;
+}
+
+void meter_feed(AudioMeter *m, const uint8_t *data, int nb_frames, enum AVSampleFormat fmt)
+{
+    int bps = av_get_bytes_per_sample(fmt);
+
+    while (nb_frames > 0)
+    {
+        int n = FFMIN(nb_frames, m->interval - m->frames);
+
+        if (fmt == AV_SAMPLE_FMT_FLT)
+        {
+            meter_levels(m, (const float *)data, n * m->stride);
+        }
+        else
+        {
+            /* whole sample frames per chunk */
+            int chunk = FFMAX(METER_CHUNK / m->stride, 1);
+            const int16_t *src = (const int16_t *)data;
+            int i, done;
+
+            for (done = 0; done < n; done += chunk)
+            {
+                int len = FFMIN(chunk, n - done) * m->stride;
+
+                if (len > METER_CHUNK)
+                    break;
+                for (i = 0; i < len; i++)
+                    m->scratch[i] = src[i] * (1.0f / 32768);
+                meter_levels(m, m->scratch, len);
+                src += len;
+            }
+        }
+
+        data += n * m->stride * bps;
+        nb_frames -= n;
+        if ((m->frames += n) >= m->interval)
+            meter_report(m);
+    }
+}
+
+void meter_free(AudioMeter *m)
+{
+    av_tx_uninit(&m->tx);
+    av_freep(&m->window);
+    av_freep(&m->fft_in);
+    av_freep(&m->fft_out);
+    m->interval = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FFCLIENT_METER_H
+#define FFCLIENT_METER_H
+
+#include <inttypes.h>
+
+#include <libavutil/samplefmt.h>
+#include <libavutil/tx.h>
+
+#define METER_MAX_CHANNELS 8
+#define METER_MAX_BANDS 32
+#define METER_FFT_BITS 10
+#define METER_FFT_SIZE (1 << METER_FFT_BITS)
+/* samples converted from s16 at a time */
+#define METER_CHUNK 1024
+
+/*
+ * Report sent to the host, levels in 1/100 dBFS (s16 LE, -10000 is silence):
+ *   u8 channels, u8 bands, channels * (s16 rms, s16 peak), bands * s16 power
+ * bands are log spaced from METER_LOW_HZ to half the sample rate
+ */
+#define METER_REPORT_SIZE(channels, bands) (2 + (channels) * 4 + (bands) * 2)
+#define METER_LOW_HZ 40
+
+typedef struct AudioMeter
+{
+    int channels;    /* metered, the first METER_MAX_CHANNELS */
+    int stride;      /* channels in the input */
+    int sample_rate;
+    int interval;    /* sample frames per report */
+    int frames;      /* since the last report */
+    double sum[METER_MAX_CHANNELS];
+    float peak[METER_MAX_CHANNELS];
+
+    int nb_bands;
+    int band_start[METER_MAX_BANDS + 1]; /* first rdft bin of each band */
+    float history[METER_FFT_SIZE];       /* mono, circular */
+    int history_pos;
+    float *window;
+    float *fft_in;
+    AVComplexFloat *fft_out;
+    AVTXContext *tx;
+    av_tx_fn tx_fn;
+    float scratch[METER_CHUNK];
+
+    void (*report)(void *opaque, const uint8_t *data, int size);
+    void *opaque;
+} AudioMeter;
+
+int meter_init(AudioMeter *m, int sample_rate, int channels, int rate, int bands,
+    void (*report)(void *opaque, const uint8_t *data, int size), void *opaque);
+/* fmt is AV_SAMPLE_FMT_S16 or AV_SAMPLE_FMT_FLT, interleaved */
+void meter_feed(AudioMeter *m, const uint8_t *data, int nb_frames, enum AVSampleFormat fmt);
+void meter_free(AudioMeter *m);
+
+#endif
@@ -0,0 +1,265 @@
+#include "mosaic.h"
+#include "utils.h"
+
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+
+/*
+ * mosaic canvas
+ *
+ * several sessions scale straight into their own area of one shared memory, the host does not
+ * have to put them together.
+ * Only a session with a new picture draws its area again.
+ */
+static Mosaic mosaic;
+
+int mosaic_init(void)
+{
+    memset(&mosaic, 0, sizeof(mosaic));
+    if (!(mosaic.mutex = SDL_CreateMutex()) || !(mosaic.cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        mosaic_uninit();
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void mosaic_uninit(void)
+{
+    if (mosaic.mutex)
+        mosaic_close();
+    if (mosaic.cond)
+        SDL_DestroyCond(mosaic.cond);
+    if (mosaic.mutex)
+        SDL_DestroyMutex(mosaic.mutex);
+    memset(&mosaic, 0, sizeof(mosaic));
+}
+
+/* must hold the mutex, returns with no worker touching the canvas */
+static void mosaic_wait_idle(void)
+{
+    while (mosaic.users)
+        SDL_CondWait(mosaic.cond, mosaic.mutex);
+}
+
+static void mosaic_clear(void)
+{
+    uint32_t *p = mosaic.shm.ptr;
+    int i;
+
+    if (!p)
+        return;
+    /* opaque black in BGRA */
+    for (i = 0; i < mosaic.width * mosaic.height; i++)
+        p[i] = 0xff000000;
+}
+
+static int mosaic_add_tile(MosaicTile *tiles, int nb_tiles, int session, int x, int y, int w, int h,
+    int width, int height)
+{
+    MosaicTile *tile;
+
+    if (nb_tiles >= MOSAIC_MAX_TILES)
+        return nb_tiles;
+
+    x = av_clip(x, 0, width);
+    y = av_clip(y, 0, height);
+    w = FFMIN(w, width - x);
+    h = FFMIN(h, height - y);
+    if (w < 2 || h < 2)
+    {
+        av_log(NULL, AV_LOG_WARNING, "Mosaic tile of session %d is outside the canvas\n", session);
+        return nb_tiles;
+    }
+
+    tile = &tiles[nb_tiles];
+    tile->session = session;
+    tile->x = x;
+    tile->y = y;
+    tile->w = w;
+    tile->h = h;
+    return nb_tiles + 1;
+}
+
+/*
+ * payload is NUL separated:
+ *   mem_name width height grid cols rows session...
+ *   mem_name width height rect session x y w h [session x y w h ...]
+ */
+int mosaic_layout(char *data, int size)
+{
+    char *argv[4 + 5 * MOSAIC_MAX_TILES];
+    MosaicTile tiles[MOSAIC_MAX_TILES];
+    int argc = 0, nb_tiles = 0;
+    int width, height, i;
+    char *p = data;
+    char *end = data + size;
+
+    while (p < end && argc < FF_ARRAY_ELEMS(argv))
+    {
+        argv[argc++] = p;
+        p += strlen(p) + 1;
+    }
+
+    if (argc < 4)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Mosaic layout needs memory name, width, height and mode\n");
+        return AVERROR(EINVAL);
+    }
+
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+    if (width <= 0 || height <= 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Invalid mosaic size %dx%d\n", width, height);
+        return AVERROR(EINVAL);
+    }
+
+    if (!strcmp(argv[3], "grid"))
+    {
+        int cols, rows;
+
+        if (argc < 6 || (cols = atoi(argv[4])) <= 0 || (rows = atoi(argv[5])) <= 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Mosaic grid needs columns and rows\n");
+            return AVERROR(EINVAL);
+        }
+        for (i = 6; i < argc && i - 6 < cols * rows; i++)
+        {
+            int col = (i - 6) % cols;
+            int row = (i - 6) / cols;
+
+            nb_tiles = mosaic_add_tile(tiles, nb_tiles, atoi(argv[i]),
+                col * width / cols, row * height / rows, width / cols, height / rows,
+                width, height);
+        }
+    }
+    else if (!strcmp(argv[3], "rect"))
+    {
+        for (i = 4; i + 4 < argc; i += 5)
+        {
+            nb_tiles = mosaic_add_tile(tiles, nb_tiles, atoi(argv[i]),
+                atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]), atoi(argv[i + 4]),
+                width, height);
+        }
+    }
+    else
+    {
+        av_log(NULL, AV_LOG_ERROR, "Unknown mosaic mode %s\n", argv[3]);
+        return AVERROR(EINVAL);
+    }
+
+    SDL_LockMutex(mosaic.mutex);
+    mosaic_wait_idle();
+
+    if (!mosaic.shm.ptr || width != mosaic.width || height != mosaic.height)
+    {
+        share_mem_close(&mosaic.shm);
+        mosaic.width = width;
+        mosaic.height = height;
+        if (socket_conn && socket_send_image_size(MOSAIC_SESSION, &mosaic.shm, argv[0], width, height, 0) < 0)
+        {
+            /* the sessions keep publishing on their own */
+            mosaic.nb_tiles = 0;
+            mosaic.width = mosaic.height = 0;
+            SDL_UnlockMutex(mosaic.mutex);
+            return AVERROR(EINVAL);
+        }
+    }
+    memcpy(mosaic.tiles, tiles, nb_tiles * sizeof(*tiles));
+    mosaic.nb_tiles = nb_tiles;
+    mosaic_clear();
+
+    SDL_UnlockMutex(mosaic.mutex);
+
+    av_log(NULL, AV_LOG_INFO, "Mosaic %dx%d with %d tiles\n", width, height, nb_tiles);
+    return 0;
+}
+
+void mosaic_close(void)
+{
+    SDL_LockMutex(mosaic.mutex);
+    mosaic_wait_idle();
+    mosaic.nb_tiles = 0;
+    share_mem_close(&mosaic.shm);
+    mosaic.width = mosaic.height = 0;
+    SDL_UnlockMutex(mosaic.mutex);
+}
+
+/*
+ * returns 1 when the session has a tile, 0 when it has none. The frame is only
+ * drawn with draw set, a tile that cannot be drawn stays as it is.
+ */
+int mosaic_draw(int session, AVFrame *frame, struct SwsContext **sws_ctx, int draw)
+{
+    MosaicTile tile;
+    SDL_Rect rect;
+    uint8_t *dst_data[4] = {NULL};
+    int dst_linesize[4] = {0};
+    uint8_t *canvas = NULL;
+    int stride = 0;
+    int found = 0;
+    int ret, i;
+
+    if (!mosaic.mutex)
+        return 0;
+
+    SDL_LockMutex(mosaic.mutex);
+    if (mosaic.shm.ptr)
+    {
+        for (i = 0; i < mosaic.nb_tiles; i++)
+        {
+            if (mosaic.tiles[i].session == session)
+            {
+                tile = mosaic.tiles[i];
+                found = 1;
+                break;
+            }
+        }
+    }
+    if (found)
+    {
+        mosaic.users++;
+        canvas = mosaic.shm.ptr;
+        stride = mosaic.width * 4;
+    }
+    SDL_UnlockMutex(mosaic.mutex);
+
+    if (!found)
+        return 0;
+    ret = 1;
+    if (!draw)
+        goto end;
+
+    /* keep the aspect ratio inside the tile */
+    calculate_display_rect(&rect, tile.w, tile.h, frame->width, frame->height, frame->sample_aspect_ratio);
+    rect.x = tile.x + (tile.w - rect.w) / 2;
+    rect.y = tile.y + (tile.h - rect.h) / 2;
+    if (rect.w <= 0 || rect.h <= 0)
+        goto end;
+
+    *sws_ctx = sws_getCachedContext(*sws_ctx, frame->width, frame->height, frame->format,
+        rect.w, rect.h, AV_PIX_FMT_BGRA, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!*sws_ctx)
+    {
+        /* only this tile is left alone, the session keeps playing */
+        av_log(NULL, AV_LOG_ERROR, "Cannot initialize the mosaic conversion context for session %d\n", session);
+    }
+    else
+    {
+        dst_data[0] = canvas + rect.y * stride + rect.x * 4;
+        dst_linesize[0] = stride;
+        sws_scale(*sws_ctx, (const uint8_t *const *)frame->data, frame->linesize,
+            0, frame->height, dst_data, dst_linesize);
+    }
+
+end:
+    SDL_LockMutex(mosaic.mutex);
+    mosaic.users--;
+    SDL_CondBroadcast(mosaic.cond);
+    SDL_UnlockMutex(mosaic.mutex);
+    return ret;
+}
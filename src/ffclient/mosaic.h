@@ -0,0 +1,44 @@
+#ifndef FFCLIENT_MOSAIC_H
+#define FFCLIENT_MOSAIC_H
+
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#include "socket.h"
+
+#define MOSAIC_MAX_TILES 256
+/* session id used in the image size message of the canvas */
+#define MOSAIC_SESSION 0xffff
+
+typedef struct MosaicTile
+{
+    int session;
+    int x, y, w, h;
+} MosaicTile;
+
+/* one canvas in shared memory, every tile is fed by one session */
+typedef struct Mosaic
+{
+    ShareMem shm;
+    int width;
+    int height;
+    MosaicTile tiles[MOSAIC_MAX_TILES];
+    int nb_tiles;
+    int users; /* workers drawing right now */
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+} Mosaic;
+
+int mosaic_init(void);
+void mosaic_uninit(void);
+int mosaic_layout(char *data, int size);
+void mosaic_close(void);
+int mosaic_draw(int session, AVFrame *frame, struct SwsContext **sws_ctx, int draw);
+
+#endif
@@ -0,0 +1,135 @@
+#include "nullsink.h"
+
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+/* further behind than this, e.g. after the machine was suspended, the timer starts over */
+#define NULL_SINK_MAX_LATE 1000000
+
+/*
+ * audio output without a sound card
+ *
+ * servers and CI machines have no sound card, audio is no longer disabled when the SDL
+ * device cannot be opened.
+ * A thread calls the audio callback periodically at the real time pace of the sample rate, the
+ * callback updates the audio clock as usual,
+ * so sync behaves as with a real device. The PCM taken out can be written to a file or a pipe.
+ */
+static int null_sink_thread(void *arg)
+{
+    NullSink *sink = arg;
+    int64_t next = av_gettime_relative();
+    int64_t period_us = (int64_t)sink->period * 1000000 / sink->bytes_per_sec;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    while (!SDL_AtomicGet(&sink->abort))
+    {
+        int64_t now;
+
+        if (SDL_AtomicGet(&sink->paused))
+        {
+            /* a paused device does not call back either */
+            SDL_LockMutex(sink->mutex);
+            while (SDL_AtomicGet(&sink->paused) && !SDL_AtomicGet(&sink->abort))
+                SDL_CondWait(sink->cond, sink->mutex);
+            SDL_UnlockMutex(sink->mutex);
+            next = av_gettime_relative();
+            continue;
+        }
+
+        sink->callback(sink->opaque, sink->buf, sink->period);
+        if (sink->dump)
+        {
+            avio_write(sink->dump, sink->buf, sink->period);
+            if (sink->dump->error < 0)
+            {
+                av_log(NULL, AV_LOG_ERROR, "Audio dump failed: %s, stop writing\n",
+                    av_err2str(sink->dump->error));
+                avio_closep(&sink->dump);
+            }
+        }
+
+        /* absolute deadlines, the time spent in the callback does not add up */
+        next += period_us;
+        now = av_gettime_relative();
+        if (now - next > NULL_SINK_MAX_LATE)
+            next = now;
+        else if (next > now)
+            av_usleep((unsigned)(next - now));
+    }
+    return 0;
+}
+
+int null_sink_open(NullSink *sink, SDL_AudioCallback callback, void *opaque,
+    int bytes_per_sec, int period, const char *dump_url)
+{
+    int ret;
+
+    memset(sink, 0, sizeof(*sink));
+    if (bytes_per_sec <= 0 || period <= 0)
+        return AVERROR(EINVAL);
+    sink->callback = callback;
+    sink->opaque = opaque;
+    sink->bytes_per_sec = bytes_per_sec;
+    sink->period = period;
+    if (!(sink->buf = av_malloc(period)))
+        return AVERROR(ENOMEM);
+    if (!(sink->mutex = SDL_CreateMutex()) || !(sink->cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    if (dump_url && (ret = avio_open(&sink->dump, dump_url, AVIO_FLAG_WRITE)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open audio dump %s: %s\n", dump_url, av_err2str(ret));
+        goto fail;
+    }
+
+    /* starts paused like an SDL device */
+    SDL_AtomicSet(&sink->paused, 1);
+    if (!(sink->tid = SDL_CreateThread(null_sink_thread, "null_sink", sink)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    null_sink_close(sink);
+    return ret;
+}
+
+void null_sink_pause(NullSink *sink, int pause)
+{
+    SDL_LockMutex(sink->mutex);
+    SDL_AtomicSet(&sink->paused, pause);
+    SDL_CondSignal(sink->cond);
+    SDL_UnlockMutex(sink->mutex);
+}
+
+void null_sink_close(NullSink *sink)
+{
+    if (sink->tid)
+    {
+        SDL_LockMutex(sink->mutex);
+        SDL_AtomicSet(&sink->abort, 1);
+        SDL_CondSignal(sink->cond);
+        SDL_UnlockMutex(sink->mutex);
+        SDL_WaitThread(sink->tid, NULL);
+    }
+    avio_closep(&sink->dump);
+    av_freep(&sink->buf);
+    if (sink->cond)
+        SDL_DestroyCond(sink->cond);
+    if (sink->mutex)
+        SDL_DestroyMutex(sink->mutex);
+    memset(sink, 0, sizeof(*sink));
+}
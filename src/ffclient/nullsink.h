@@ -0,0 +1,39 @@
+#ifndef FFCLIENT_NULLSINK_H
+#define FFCLIENT_NULLSINK_H
+
+#include <inttypes.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#include <libavformat/avformat.h>
+
+/*
+ * audio output without a device: a thread pulls one period from the
+ * callback at the real time rate, the PCM goes to a file or a pipe or nowhere
+ */
+typedef struct NullSink
+{
+    SDL_AudioCallback callback;
+    void *opaque;
+    int bytes_per_sec;
+    int period; /* bytes per callback, like SDL_AudioSpec.size */
+    uint8_t *buf;
+    AVIOContext *dump;
+    SDL_Thread *tid;
+    SDL_atomic_t abort;
+    SDL_atomic_t paused;
+    /* the thread sleeps on cond while paused */
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+} NullSink;
+
+int null_sink_open(NullSink *sink, SDL_AudioCallback callback, void *opaque,
+    int bytes_per_sec, int period, const char *dump_url);
+void null_sink_pause(NullSink *sink, int pause);
+void null_sink_close(NullSink *sink);
+
+#endif
@@ -0,0 +1,206 @@
+#include "pcmring.h"
+
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+
+/*
+ * lock free PCM ring buffer
+ *
+ * the resampling thread converts the sound ahead of time into the ring, the SDL audio callback
+ * only copies bytes and applies the volume,
+ * it neither waits on the frame queue nor runs swr_convert on the real time thread.
+ * Every chunk starts with a mark (end position, audio clock at the end, serial), the callback
+ * computes the clock from the marks,
+ * and data from before a seek is dropped by serial.
+ */
+int pcm_ring_init(PcmRing *ring, int min_size)
+{
+    int size = 4096;
+
+    memset(ring, 0, sizeof(*ring));
+    while (size < min_size && size < (1 << 30))
+        size <<= 1;
+    ring->data = av_malloc(size);
+    ring->space = SDL_CreateSemaphore(0);
+    if (!ring->data || !ring->space)
+    {
+        pcm_ring_free(ring);
+        return AVERROR(ENOMEM);
+    }
+    ring->size = size;
+    ring->last.serial = -1;
+    return 0;
+}
+
+void pcm_ring_free(PcmRing *ring)
+{
+    av_freep(&ring->data);
+    if (ring->space)
+        SDL_DestroySemaphore(ring->space);
+    memset(ring, 0, sizeof(*ring));
+}
+
+int pcm_ring_space(PcmRing *ring)
+{
+    uint32_t w = SDL_AtomicGet(&ring->write);
+    uint32_t r = SDL_AtomicGet(&ring->read);
+
+    return ring->size - (int)(w - r);
+}
+
+/* announce the next len bytes before they are written, < 0 while the marks are all in use */
+int pcm_ring_mark(PcmRing *ring, int len, double pts, int serial)
+{
+    uint32_t mw = SDL_AtomicGet(&ring->mark_write);
+    uint32_t mr = SDL_AtomicGet(&ring->mark_read);
+    PcmMark *mark;
+
+    if (mw - mr >= PCM_RING_MARKS)
+        return AVERROR(EAGAIN);
+
+    mark = &ring->marks[mw % PCM_RING_MARKS];
+    mark->end = (uint32_t)SDL_AtomicGet(&ring->write) + len;
+    mark->pts = pts;
+    mark->serial = serial;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->mark_write, mw + 1);
+    return 0;
+}
+
+/* returns the bytes written, less than len when the ring is full */
+int pcm_ring_write(PcmRing *ring, const uint8_t *data, int len)
+{
+    uint32_t w = SDL_AtomicGet(&ring->write);
+    int offset = w & (ring->size - 1);
+    int n, n1;
+
+    n = FFMIN(len, pcm_ring_space(ring));
+    n1 = FFMIN(n, ring->size - offset);
+    memcpy(ring->data + offset, data, n1);
+    memcpy(ring->data, data + n1, n - n1);
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->write, w + n);
+    return n;
+}
+
+static int pcm_ring_writable(PcmRing *ring, int space)
+{
+    uint32_t mw = SDL_AtomicGet(&ring->mark_write);
+    uint32_t mr = SDL_AtomicGet(&ring->mark_read);
+
+    return mw - mr < PCM_RING_MARKS && pcm_ring_space(ring) >= space;
+}
+
+/*
+ * blocks until space bytes and a mark are free, INT_MAX only returns on pcm_ring_wake().
+ * May return early, the caller checks again.
+ */
+void pcm_ring_wait(PcmRing *ring, int space)
+{
+    ring->wake_space = space;
+    SDL_AtomicSet(&ring->waiting, 1);
+    if (pcm_ring_writable(ring, space) && SDL_AtomicCAS(&ring->waiting, 1, 0))
+        return;
+    SDL_SemWait(ring->space);
+}
+
+/* pause, resume and abort, the state the producer sleeps on changed */
+void pcm_ring_wake(PcmRing *ring)
+{
+    if (!ring->space)
+        return;
+    SDL_AtomicSet(&ring->waiting, 0);
+    SDL_SemPost(ring->space);
+}
+
+int pcm_ring_fill(PcmRing *ring)
+{
+    uint32_t w = SDL_AtomicGet(&ring->write);
+    uint32_t r = SDL_AtomicGet(&ring->read);
+
+    return (int)(w - r);
+}
+
+/* up to len readable bytes in one piece, the rest follows after consuming them */
+int pcm_ring_peek(PcmRing *ring, uint8_t **data, int len)
+{
+    uint32_t r = SDL_AtomicGet(&ring->read);
+    int offset = r & (ring->size - 1);
+    int n = pcm_ring_fill(ring);
+
+    SDL_MemoryBarrierAcquire();
+    n = FFMIN(FFMIN(n, len), ring->size - offset);
+    *data = ring->data + offset;
+    return n;
+}
+
+static PcmMark *pcm_ring_current_mark(PcmRing *ring)
+{
+    uint32_t mw = SDL_AtomicGet(&ring->mark_write);
+    uint32_t mr = SDL_AtomicGet(&ring->mark_read);
+
+    if (mw == mr)
+        return NULL;
+    SDL_MemoryBarrierAcquire();
+    return &ring->marks[mr % PCM_RING_MARKS];
+}
+
+void pcm_ring_consume(PcmRing *ring, int len)
+{
+    uint32_t r = (uint32_t)SDL_AtomicGet(&ring->read) + len;
+    PcmMark *mark;
+
+    /* marks that were played to the end */
+    while ((mark = pcm_ring_current_mark(ring)) && (int32_t)(mark->end - r) <= 0)
+    {
+        ring->last = *mark;
+        SDL_AtomicAdd(&ring->mark_read, 1);
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->read, r);
+
+    /* a semaphore post does not block the audio callback */
+    if (SDL_AtomicGet(&ring->waiting) && pcm_ring_writable(ring, ring->wake_space) &&
+        SDL_AtomicCAS(&ring->waiting, 1, 0))
+        SDL_SemPost(ring->space);
+}
+
+/* samples converted before a seek are skipped instead of played */
+void pcm_ring_drop_stale(PcmRing *ring, int serial)
+{
+    PcmMark *mark;
+
+    while ((mark = pcm_ring_current_mark(ring)) && mark->serial != serial)
+    {
+        int left = (int32_t)(mark->end - (uint32_t)SDL_AtomicGet(&ring->read));
+        int n = FFMAX(FFMIN(pcm_ring_fill(ring), left), 0);
+
+        pcm_ring_consume(ring, n);
+        /* the producer is still writing this block */
+        if (n < left)
+            break;
+    }
+}
+
+/* audio clock at the read position, 0 when nothing was converted yet */
+int pcm_ring_clock(PcmRing *ring, int bytes_per_sec, double *pts, int *serial)
+{
+    uint32_t r = SDL_AtomicGet(&ring->read);
+    PcmMark *mark = pcm_ring_current_mark(ring);
+
+    if (mark)
+    {
+        *pts = mark->pts - (double)(int32_t)(mark->end - r) / bytes_per_sec;
+        *serial = mark->serial;
+        return 1;
+    }
+    if (ring->last.serial < 0)
+        return 0;
+    *pts = ring->last.pts + (double)(int32_t)(r - ring->last.end) / bytes_per_sec;
+    *serial = ring->last.serial;
+    return 1;
+}
@@ -0,0 +1,62 @@
+#ifndef FFCLIENT_PCMRING_H
+#define FFCLIENT_PCMRING_H
+
+#include <inttypes.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#define PCM_RING_MARKS 256
+
+/* where a converted frame ends in the ring and the audio clock at that point */
+typedef struct PcmMark
+{
+    uint32_t end;
+    double pts;
+    int serial;
+} PcmMark;
+
+/*
+ * single producer, single consumer byte ring: the producer thread writes
+ * converted samples, the audio callback reads them without taking a lock.
+ * Positions only grow and wrap around at 2^32, size is a power of two.
+ */
+typedef struct PcmRing
+{
+    uint8_t *data;
+    int size;
+    SDL_atomic_t write;
+    SDL_atomic_t read;
+
+    PcmMark marks[PCM_RING_MARKS];
+    SDL_atomic_t mark_write;
+    SDL_atomic_t mark_read;
+    PcmMark last; /* consumer side, the last mark that was played to the end */
+
+    /* the producer sleeps until wake_space bytes and a mark are free, or pcm_ring_wake() */
+    SDL_sem *space;
+    SDL_atomic_t waiting;
+    int wake_space;
+} PcmRing;
+
+int pcm_ring_init(PcmRing *ring, int min_size);
+void pcm_ring_free(PcmRing *ring);
+
+/* producer */
+int pcm_ring_space(PcmRing *ring);
+int pcm_ring_mark(PcmRing *ring, int len, double pts, int serial);
+int pcm_ring_write(PcmRing *ring, const uint8_t *data, int len);
+void pcm_ring_wait(PcmRing *ring, int space);
+void pcm_ring_wake(PcmRing *ring);
+
+/* consumer */
+int pcm_ring_fill(PcmRing *ring);
+int pcm_ring_peek(PcmRing *ring, uint8_t **data, int len);
+void pcm_ring_consume(PcmRing *ring, int len);
+void pcm_ring_drop_stale(PcmRing *ring, int serial);
+int pcm_ring_clock(PcmRing *ring, int bytes_per_sec, double *pts, int *serial);
+
+#endif
@@ -0,0 +1,379 @@
+#include "playlist.h"
+
+#include <string.h>
+
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+/* larger playlist files are cut */
+#define PLAYLIST_MAX_SIZE (1024 * 1024)
+
+/*
+ * gapless playlist
+ *
+ * while the current item plays, a background thread opens the next one, probes its streams
+ * and reads its first packets ahead.
+ * At the end of the current item the read thread goes on with those packets without waiting
+ * for the open and the probe.
+ */
+void playlist_next_free(PlaylistNext *next)
+{
+    int i;
+
+    for (i = 0; i < next->nb_packets; i++)
+        av_packet_free(&next->packets[i]);
+    av_freep(&next->packets);
+    avformat_close_input(&next->ic);
+    av_freep(&next->url);
+    memset(next, 0, sizeof(*next));
+    next->index = -1;
+    next->video_stream = -1;
+    next->audio_stream = -1;
+}
+
+/* open the item and read up to the first keyframe and a few packets beyond */
+static int playlist_preroll(Playlist *pl, PlaylistNext *next)
+{
+    AVPacket *pkt = NULL;
+    int64_t start = AV_NOPTS_VALUE;
+    int need_video, need_audio;
+    int ret;
+
+    if ((ret = pl->open(pl->opaque, next->url, next)) < 0)
+        return ret;
+    need_video = next->video_stream >= 0;
+    need_audio = next->audio_stream >= 0;
+
+    next->packets = av_calloc(PLAYLIST_PREROLL_MAX, sizeof(*next->packets));
+    pkt = av_packet_alloc();
+    if (!next->packets || !pkt)
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (!pl->abort && next->nb_packets < PLAYLIST_PREROLL_MAX &&
+        (need_video || need_audio || next->nb_packets < PLAYLIST_PREROLL_PACKETS))
+    {
+        AVStream *st;
+
+        ret = av_read_frame(next->ic, pkt);
+        if (ret == AVERROR(EAGAIN))
+        {
+            av_usleep(10000);
+            continue;
+        }
+        if (ret < 0)
+        {
+            /* a very short item, everything is read already */
+            if (ret == AVERROR_EOF)
+                ret = 0;
+            break;
+        }
+
+        if (pkt->stream_index != next->video_stream && pkt->stream_index != next->audio_stream)
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+        /* nothing before the first keyframe can be decoded */
+        if (pkt->stream_index == next->video_stream)
+        {
+            if (need_video && !(pkt->flags & AV_PKT_FLAG_KEY))
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            need_video = 0;
+        }
+        else
+        {
+            need_audio = 0;
+        }
+
+        st = next->ic->streams[pkt->stream_index];
+        if (pkt->pts != AV_NOPTS_VALUE)
+        {
+            int64_t ts = av_rescale_q(pkt->pts, st->time_base, AV_TIME_BASE_Q);
+
+            if (start == AV_NOPTS_VALUE || ts < start)
+                start = ts;
+        }
+
+        if (!(next->packets[next->nb_packets] = av_packet_alloc()))
+        {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        av_packet_move_ref(next->packets[next->nb_packets++], pkt);
+    }
+
+    if (start == AV_NOPTS_VALUE)
+        start = next->ic->start_time != AV_NOPTS_VALUE ? next->ic->start_time : 0;
+    next->start = start;
+    if (!ret && !next->nb_packets)
+        ret = AVERROR_INVALIDDATA;
+end:
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static int playlist_thread(void *arg)
+{
+    Playlist *pl = arg;
+
+    SDL_LockMutex(pl->mutex);
+    while (!pl->abort)
+    {
+        PlaylistNext next;
+        int ret;
+
+        if (pl->state != PLAYLIST_NEXT_REQUESTED)
+        {
+            SDL_CondWait(pl->cond, pl->mutex);
+            continue;
+        }
+
+        next = pl->next;
+        pl->state = PLAYLIST_NEXT_BUSY;
+        SDL_UnlockMutex(pl->mutex);
+
+        ret = playlist_preroll(pl, &next);
+        if (ret < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot open playlist item %d %s: %s\n",
+                next.index, next.url, av_err2str(ret));
+            avformat_close_input(&next.ic);
+        }
+
+        SDL_LockMutex(pl->mutex);
+        pl->next = next;
+        pl->state = ret < 0 ? PLAYLIST_NEXT_FAILED : PLAYLIST_NEXT_READY;
+        SDL_UnlockMutex(pl->mutex);
+
+        pl->wake(pl->opaque);
+        SDL_LockMutex(pl->mutex);
+    }
+    SDL_UnlockMutex(pl->mutex);
+    return 0;
+}
+
+int playlist_init(Playlist *pl, PlaylistOpen open, void (*wake)(void *opaque), void *opaque)
+{
+    memset(pl, 0, sizeof(*pl));
+    pl->open = open;
+    pl->wake = wake;
+    pl->opaque = opaque;
+    playlist_next_free(&pl->next);
+    if (!(pl->mutex = SDL_CreateMutex()) || !(pl->cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void playlist_free(Playlist *pl)
+{
+    int i;
+
+    if (pl->tid)
+    {
+        SDL_LockMutex(pl->mutex);
+        pl->abort = 1;
+        SDL_CondSignal(pl->cond);
+        SDL_UnlockMutex(pl->mutex);
+        SDL_WaitThread(pl->tid, NULL);
+    }
+    playlist_next_free(&pl->next);
+    for (i = 0; i < pl->nb_urls; i++)
+        av_free(pl->urls[i]);
+    av_freep(&pl->urls);
+    if (pl->cond)
+        SDL_DestroyCond(pl->cond);
+    if (pl->mutex)
+        SDL_DestroyMutex(pl->mutex);
+    memset(pl, 0, sizeof(*pl));
+}
+
+int playlist_append(Playlist *pl, const char *url)
+{
+    char **urls;
+    char *copy = av_strdup(url);
+
+    if (!copy)
+        return AVERROR(ENOMEM);
+
+    SDL_LockMutex(pl->mutex);
+    urls = av_realloc_array(pl->urls, pl->nb_urls + 1, sizeof(*urls));
+    if (urls)
+    {
+        pl->urls = urls;
+        pl->urls[pl->nb_urls++] = copy;
+    }
+    SDL_UnlockMutex(pl->mutex);
+
+    if (!urls)
+    {
+        av_free(copy);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/*
+ * one url per line, empty lines and lines starting with # are skipped,
+ * so plain m3u files work. Relative paths are taken from the playlist folder.
+ */
+int playlist_load(Playlist *pl, const char *path)
+{
+    AVIOContext *pb = NULL;
+    AVBPrint bp;
+    char *data = NULL, *line, *next;
+    const char *slash;
+    int dir_len, ret;
+
+    if ((ret = avio_open(&pb, path, AVIO_FLAG_READ)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open playlist %s: %s\n", path, av_err2str(ret));
+        return ret;
+    }
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    ret = avio_read_to_bprint(pb, &bp, PLAYLIST_MAX_SIZE);
+    avio_closep(&pb);
+    if (ret < 0 || (ret = av_bprint_finalize(&bp, &data)) < 0)
+    {
+        av_bprint_finalize(&bp, NULL);
+        return ret;
+    }
+
+    slash = strrchr(path, '/');
+    if (!slash || (strrchr(path, '\\') && strrchr(path, '\\') > slash))
+        slash = strrchr(path, '\\');
+    dir_len = slash ? (int)(slash - path + 1) : 0;
+
+    for (line = data; line && !ret; line = next)
+    {
+        char *end;
+
+        if ((next = strchr(line, '\n')))
+            *next++ = 0;
+        line += strspn(line, " \t\r");
+        end = line + strlen(line);
+        while (end > line && strchr(" \t\r", end[-1]))
+            *--end = 0;
+        if (!*line || *line == '#')
+            continue;
+
+        if (dir_len && !strstr(line, "://") && !strchr("/\\", line[0]) && line[1] != ':')
+        {
+            char *full = av_asprintf("%.*s%s", dir_len, path, line);
+
+            ret = full ? playlist_append(pl, full) : AVERROR(ENOMEM);
+            av_free(full);
+        }
+        else
+        {
+            ret = playlist_append(pl, line);
+        }
+    }
+    av_free(data);
+
+    if (!ret && !pl->nb_urls)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Playlist %s is empty\n", path);
+        ret = AVERROR_INVALIDDATA;
+    }
+    return ret;
+}
+
+/* a copy, the list may grow at any time */
+char *playlist_url(Playlist *pl, int index)
+{
+    char *url = NULL;
+
+    SDL_LockMutex(pl->mutex);
+    if (index >= 0 && index < pl->nb_urls)
+        url = av_strdup(pl->urls[index]);
+    SDL_UnlockMutex(pl->mutex);
+    return url;
+}
+
+/* the item after the current one, -1 at the end of a list that does not wrap */
+int playlist_next_index(Playlist *pl, int wrap)
+{
+    int index;
+
+    SDL_LockMutex(pl->mutex);
+    index = pl->current + 1;
+    if (index >= pl->nb_urls)
+        index = wrap && pl->nb_urls ? 0 : -1;
+    SDL_UnlockMutex(pl->mutex);
+    return index;
+}
+
+/* start opening the item, nothing happens while another one is pending */
+void playlist_prepare(Playlist *pl, int index)
+{
+    SDL_LockMutex(pl->mutex);
+    if (pl->state == PLAYLIST_NEXT_NONE && index >= 0 && index < pl->nb_urls)
+    {
+        if (!pl->tid && !(pl->tid = SDL_CreateThread(playlist_thread, "playlist", pl)))
+        {
+            av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        }
+        else if ((pl->next.url = av_strdup(pl->urls[index])))
+        {
+            pl->next.index = index;
+            pl->state = PLAYLIST_NEXT_REQUESTED;
+            SDL_CondSignal(pl->cond);
+        }
+    }
+    SDL_UnlockMutex(pl->mutex);
+}
+
+int playlist_state(Playlist *pl)
+{
+    int state;
+
+    SDL_LockMutex(pl->mutex);
+    state = pl->state;
+    SDL_UnlockMutex(pl->mutex);
+    return state;
+}
+
+/*
+ * moves the prepared item out, it becomes the current one.
+ * 1 ready, 0 nothing prepared, AVERROR(EAGAIN) still opening, another error when it failed
+ */
+int playlist_take(Playlist *pl, PlaylistNext *next)
+{
+    int ret;
+
+    SDL_LockMutex(pl->mutex);
+    switch (pl->state)
+    {
+    case PLAYLIST_NEXT_READY:
+    case PLAYLIST_NEXT_FAILED:
+        ret = pl->state == PLAYLIST_NEXT_READY ? 1 : AVERROR_INVALIDDATA;
+        *next = pl->next;
+        pl->current = next->index;
+        memset(&pl->next, 0, sizeof(pl->next));
+        playlist_next_free(&pl->next);
+        pl->state = PLAYLIST_NEXT_NONE;
+        break;
+    case PLAYLIST_NEXT_NONE:
+        ret = 0;
+        break;
+    default:
+        ret = AVERROR(EAGAIN);
+        break;
+    }
+    SDL_UnlockMutex(pl->mutex);
+    return ret;
+}
@@ -0,0 +1,73 @@
+#ifndef FFCLIENT_PLAYLIST_H
+#define FFCLIENT_PLAYLIST_H
+
+#include <inttypes.h>
+
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+/* packets read ahead from the next item, enough to start the decoders right away */
+#define PLAYLIST_PREROLL_PACKETS 32
+#define PLAYLIST_PREROLL_MAX 512
+
+enum PlaylistNextState
+{
+    PLAYLIST_NEXT_NONE,
+    PLAYLIST_NEXT_REQUESTED,
+    PLAYLIST_NEXT_BUSY,
+    PLAYLIST_NEXT_READY,
+    PLAYLIST_NEXT_FAILED,
+};
+
+/* the item after the current one, opened and probed while the current one plays */
+typedef struct PlaylistNext
+{
+    int index;
+    char *url;
+    AVFormatContext *ic;
+    int video_stream;
+    int audio_stream;
+    AVPacket **packets; /* read ahead, in demuxer order */
+    int nb_packets;
+    int64_t start; /* AV_TIME_BASE, first presentation timestamp of the item */
+} PlaylistNext;
+
+/* opens and probes url, picks the streams and leaves the others discarded */
+typedef int (*PlaylistOpen)(void *opaque, const char *url, PlaylistNext *next);
+
+typedef struct Playlist
+{
+    char **urls;
+    int nb_urls;
+    int current;
+
+    PlaylistOpen open;
+    void (*wake)(void *opaque); /* the next item is ready or failed */
+    void *opaque;
+
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    SDL_Thread *tid;
+    int abort;
+    int state; /* enum PlaylistNextState */
+    PlaylistNext next;
+} Playlist;
+
+int playlist_init(Playlist *pl, PlaylistOpen open, void (*wake)(void *opaque), void *opaque);
+void playlist_free(Playlist *pl);
+int playlist_append(Playlist *pl, const char *url);
+int playlist_load(Playlist *pl, const char *path);
+char *playlist_url(Playlist *pl, int index);
+int playlist_next_index(Playlist *pl, int wrap);
+void playlist_prepare(Playlist *pl, int index);
+int playlist_state(Playlist *pl);
+int playlist_take(Playlist *pl, PlaylistNext *next);
+void playlist_next_free(PlaylistNext *next);
+
+#endif
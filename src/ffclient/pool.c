@@ -0,0 +1,298 @@
+#include "pool.h"
+
+#include <libavutil/log.h>
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+/*
+ * worker pool shared by the process
+ *
+ * every worker has its own queue, tasks are submitted round robin and a worker with an empty
+ * queue steals from the others.
+ * A counting gate limits how many tasks of the whole process use a CPU at once (the core budget),
+ * the decoder threads pass it too and sessions of higher priority get a slot first.
+ */
+typedef struct Pool
+{
+    PoolWorker workers[POOL_MAX_THREADS];
+    int nb_workers;
+    int budget;
+    int abort;
+    SDL_atomic_t nb_queued;
+    SDL_atomic_t next_worker;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+
+    SDL_mutex *slot_mutex;
+    SDL_cond *slot_cond;
+    int slot_free;
+    int slot_waiting[POOL_PRIORITY_NB];
+} Pool;
+
+static Pool pool;
+
+static int deque_push(PoolDeque *q, PoolTask *task)
+{
+    if (q->count == q->capacity)
+    {
+        int capacity = q->capacity ? q->capacity * 2 : 16;
+        PoolTask *tasks = av_malloc_array(capacity, sizeof(*tasks));
+        int i;
+
+        if (!tasks)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < q->count; i++)
+            tasks[i] = q->tasks[(q->head + i) % q->capacity];
+        av_free(q->tasks);
+        q->tasks = tasks;
+        q->capacity = capacity;
+        q->head = 0;
+    }
+    q->tasks[(q->head + q->count) % q->capacity] = *task;
+    q->count++;
+    return 0;
+}
+
+static int deque_pop_front(PoolDeque *q, PoolTask *task)
+{
+    if (!q->count)
+        return 0;
+    *task = q->tasks[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    return 1;
+}
+
+static int deque_pop_back(PoolDeque *q, PoolTask *task)
+{
+    if (!q->count)
+        return 0;
+    q->count--;
+    *task = q->tasks[(q->head + q->count) % q->capacity];
+    return 1;
+}
+
+static int pool_take(PoolWorker *w, PoolTask *task, int *priority)
+{
+    int i, p;
+
+    /* own queue first */
+    SDL_LockMutex(w->mutex);
+    for (p = POOL_PRIORITY_HIGH; p >= POOL_PRIORITY_LOW; p--)
+    {
+        if (deque_pop_front(&w->deque[p], task))
+        {
+            SDL_UnlockMutex(w->mutex);
+            *priority = p;
+            return 1;
+        }
+    }
+    SDL_UnlockMutex(w->mutex);
+
+    /* then steal from the other workers by priority */
+    for (p = POOL_PRIORITY_HIGH; p >= POOL_PRIORITY_LOW; p--)
+    {
+        for (i = 1; i < pool.nb_workers; i++)
+        {
+            PoolWorker *victim = &pool.workers[(w->index + i) % pool.nb_workers];
+            int ok;
+
+            SDL_LockMutex(victim->mutex);
+            ok = deque_pop_back(&victim->deque[p], task);
+            SDL_UnlockMutex(victim->mutex);
+            if (ok)
+            {
+                *priority = p;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int pool_worker_thread(void *arg)
+{
+    PoolWorker *w = arg;
+    PoolTask task;
+    int priority;
+
+    for (;;)
+    {
+        if (!pool_take(w, &task, &priority))
+        {
+            SDL_LockMutex(pool.mutex);
+            while (!pool.abort && !SDL_AtomicGet(&pool.nb_queued))
+                SDL_CondWait(pool.cond, pool.mutex);
+            if (pool.abort)
+            {
+                SDL_UnlockMutex(pool.mutex);
+                break;
+            }
+            SDL_UnlockMutex(pool.mutex);
+            continue;
+        }
+        SDL_AtomicAdd(&pool.nb_queued, -1);
+
+        pool_slot_acquire(priority);
+        task.fn(task.arg);
+        pool_slot_release(priority);
+    }
+
+    return 0;
+}
+
+int pool_init(int budget)
+{
+    int i;
+
+    if (budget <= 0)
+        budget = SDL_GetCPUCount();
+    budget = av_clip(budget, 1, POOL_MAX_THREADS);
+
+    memset(&pool, 0, sizeof(pool));
+    pool.budget = budget;
+    pool.slot_free = budget;
+    if (!(pool.mutex = SDL_CreateMutex()) || !(pool.cond = SDL_CreateCond()) ||
+        !(pool.slot_mutex = SDL_CreateMutex()) || !(pool.slot_cond = SDL_CreateCond()))
+    {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        goto fail;
+    }
+
+    for (i = 0; i < budget; i++)
+    {
+        PoolWorker *w = &pool.workers[i];
+
+        w->index = i;
+        if (!(w->mutex = SDL_CreateMutex()))
+        {
+            av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+            goto fail;
+        }
+        /* workers only start stealing once every deque exists */
+        pool.nb_workers++;
+    }
+    for (i = 0; i < budget; i++)
+    {
+        PoolWorker *w = &pool.workers[i];
+
+        w->tid = SDL_CreateThread(pool_worker_thread, "pool_worker", w);
+        if (!w->tid)
+        {
+            av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+            goto fail;
+        }
+    }
+
+    av_log(NULL, AV_LOG_INFO, "Thread pool started with %d workers\n", budget);
+    return 0;
+fail:
+    pool_uninit();
+    return AVERROR(ENOMEM);
+}
+
+void pool_uninit(void)
+{
+    int i, p;
+
+    if (pool.mutex)
+    {
+        SDL_LockMutex(pool.mutex);
+        pool.abort = 1;
+        SDL_CondBroadcast(pool.cond);
+        SDL_UnlockMutex(pool.mutex);
+    }
+
+    for (i = 0; i < pool.nb_workers; i++)
+    {
+        PoolWorker *w = &pool.workers[i];
+
+        if (w->tid)
+            SDL_WaitThread(w->tid, NULL);
+        for (p = 0; p < POOL_PRIORITY_NB; p++)
+            av_freep(&w->deque[p].tasks);
+        if (w->mutex)
+            SDL_DestroyMutex(w->mutex);
+    }
+
+    if (pool.cond)
+        SDL_DestroyCond(pool.cond);
+    if (pool.mutex)
+        SDL_DestroyMutex(pool.mutex);
+    if (pool.slot_cond)
+        SDL_DestroyCond(pool.slot_cond);
+    if (pool.slot_mutex)
+        SDL_DestroyMutex(pool.slot_mutex);
+    memset(&pool, 0, sizeof(pool));
+}
+
+int pool_budget(void)
+{
+    return pool.budget ? pool.budget : 1;
+}
+
+/* without a pool the task runs on the calling thread */
+int pool_submit(PoolTaskFn fn, void *arg, int priority)
+{
+    PoolTask task = {fn, arg};
+    PoolWorker *w;
+    int ret;
+
+    if (!pool.nb_workers)
+    {
+        fn(arg);
+        return 0;
+    }
+
+    priority = av_clip(priority, POOL_PRIORITY_LOW, POOL_PRIORITY_HIGH);
+    w = &pool.workers[(unsigned)SDL_AtomicAdd(&pool.next_worker, 1) % pool.nb_workers];
+    SDL_LockMutex(w->mutex);
+    ret = deque_push(&w->deque[priority], &task);
+    SDL_UnlockMutex(w->mutex);
+    if (ret < 0)
+        return ret;
+
+    SDL_AtomicAdd(&pool.nb_queued, 1);
+    SDL_LockMutex(pool.mutex);
+    SDL_CondSignal(pool.cond);
+    SDL_UnlockMutex(pool.mutex);
+    return 0;
+}
+
+static int slot_higher_waiting(int priority)
+{
+    int p;
+
+    for (p = priority + 1; p < POOL_PRIORITY_NB; p++)
+        if (pool.slot_waiting[p])
+            return 1;
+    return 0;
+}
+
+/* take a slot of the core budget, a waiter of higher priority goes first */
+void pool_slot_acquire(int priority)
+{
+    if (priority < 0 || !pool.slot_mutex)
+        return;
+
+    priority = FFMIN(priority, POOL_PRIORITY_HIGH);
+    SDL_LockMutex(pool.slot_mutex);
+    pool.slot_waiting[priority]++;
+    while (!pool.slot_free || slot_higher_waiting(priority))
+        SDL_CondWait(pool.slot_cond, pool.slot_mutex);
+    pool.slot_waiting[priority]--;
+    pool.slot_free--;
+    SDL_UnlockMutex(pool.slot_mutex);
+}
+
+void pool_slot_release(int priority)
+{
+    if (priority < 0 || !pool.slot_mutex)
+        return;
+
+    SDL_LockMutex(pool.slot_mutex);
+    pool.slot_free++;
+    SDL_CondBroadcast(pool.slot_cond);
+    SDL_UnlockMutex(pool.slot_mutex);
+}
@@ -0,0 +1,55 @@
+#ifndef FFCLIENT_POOL_H
+#define FFCLIENT_POOL_H
+
+#ifdef _WIN64
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif // _WIN64
+
+#define POOL_MAX_THREADS 64
+
+/* tasks without a priority bypass the core budget */
+#define POOL_PRIORITY_NONE -1
+
+enum PoolPriority
+{
+    POOL_PRIORITY_LOW,
+    POOL_PRIORITY_NORMAL,
+    POOL_PRIORITY_HIGH,
+    POOL_PRIORITY_NB
+};
+
+typedef void (*PoolTaskFn)(void *arg);
+
+typedef struct PoolTask
+{
+    PoolTaskFn fn;
+    void *arg;
+} PoolTask;
+
+/* ring buffer of tasks, the owner takes from the front and thieves from the back */
+typedef struct PoolDeque
+{
+    PoolTask *tasks;
+    int capacity;
+    int head;
+    int count;
+} PoolDeque;
+
+typedef struct PoolWorker
+{
+    int index;
+    SDL_Thread *tid;
+    SDL_mutex *mutex;
+    PoolDeque deque[POOL_PRIORITY_NB];
+} PoolWorker;
+
+int pool_init(int budget);
+void pool_uninit(void);
+int pool_budget(void);
+int pool_submit(PoolTaskFn fn, void *arg, int priority);
+void pool_slot_acquire(int priority);
+void pool_slot_release(int priority);
+
+#endif
@@ -0,0 +1,152 @@
+#include "resample.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/log.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+
+#define RESAMPLE_BENCH_SECONDS 10
+#define RESAMPLE_BENCH_BLOCK 1024
+
+/*
+ * resampler quality profiles
+ *
+ * aresample in the audio filter and the swr_ctx that audio_decode_frame compensates with
+ * use the same options. The default filter for 48k to 44.1k is costly on low end ARM,
+ * fast trades a short filter and linear interpolation for speed, hq uses soxr when available.
+ */
+static const struct
+{
+    const char *name;
+    const char *opts;
+} resample_profiles[RESAMPLE_NB] = {
+    [RESAMPLE_FAST] = { "fast", "filter_size=4:phase_shift=6:linear_interp=1:cutoff=0.9" },
+    [RESAMPLE_DEFAULT] = { "default", "" },
+    [RESAMPLE_HQ] = { "hq", "resampler=soxr:precision=28" },
+};
+
+/* swresample without libsoxr */
+static const char *resample_hq_fallback = "filter_size=64:phase_shift=12:linear_interp=1:cutoff=0.97";
+
+static int resample_has_soxr = -1;
+
+int resample_profile_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < RESAMPLE_NB; i++)
+    {
+        if (!strcmp(name, resample_profiles[i].name))
+            return i;
+    }
+    return -1;
+}
+
+const char *resample_profile_name(int profile)
+{
+    return profile >= 0 && profile < RESAMPLE_NB ? resample_profiles[profile].name : "default";
+}
+
+const char *resample_profile_opts(int profile)
+{
+    if (profile < 0 || profile >= RESAMPLE_NB)
+        profile = RESAMPLE_DEFAULT;
+
+    if (profile == RESAMPLE_HQ)
+    {
+        /* same answer from every thread, a race only probes twice */
+        if (resample_has_soxr < 0)
+        {
+            SwrContext *swr = NULL;
+            AVChannelLayout layout = AV_CHANNEL_LAYOUT_STEREO;
+
+            swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_FLT, 44100, &layout, AV_SAMPLE_FMT_FLT, 48000, 0, NULL);
+            resample_has_soxr = swr && av_set_options_string(swr, resample_profiles[RESAMPLE_HQ].opts, "=", ":") >= 0 &&
+                swr_init(swr) >= 0;
+            swr_free(&swr);
+            if (!resample_has_soxr)
+                av_log(NULL, AV_LOG_WARNING, "swresample is built without soxr, hq uses a long swr filter\n");
+        }
+        if (!resample_has_soxr)
+            return resample_hq_fallback;
+    }
+    return resample_profiles[profile].opts;
+}
+
+int resample_profile_apply(SwrContext *swr, int profile)
+{
+    const char *opts = resample_profile_opts(profile);
+    int ret;
+
+    if (!*opts)
+        return 0;
+    if ((ret = av_set_options_string(swr, opts, "=", ":")) < 0)
+        av_log(NULL, AV_LOG_ERROR, "Cannot set resampler options %s: %s\n", opts, av_err2str(ret));
+    return ret;
+}
+
+void resample_benchmark(int in_rate, int out_rate, int channels)
+{
+    AVChannelLayout layout = { 0 };
+    int out_max = (int)av_rescale_rnd(RESAMPLE_BENCH_BLOCK, out_rate, in_rate, AV_ROUND_UP) + 256;
+    float *in = av_malloc_array(RESAMPLE_BENCH_BLOCK * channels, sizeof(float));
+    float *out = av_malloc_array(out_max * channels, sizeof(float));
+    int i, j, profile;
+
+    av_channel_layout_default(&layout, channels);
+    if (!in || !out)
+        goto end;
+
+    /* a tone on every channel, the filter cost does not depend on the signal */
+    for (i = 0; i < RESAMPLE_BENCH_BLOCK; i++)
+        for (j = 0; j < channels; j++)
+            in[i * channels + j] = 0.5f * sinf(2 * M_PI * 1000 * (j + 1) * i / in_rate);
+
+    av_log(NULL, AV_LOG_INFO, "Resampling %d Hz to %d Hz, %d channels, %d s of audio\n",
+        in_rate, out_rate, channels, RESAMPLE_BENCH_SECONDS);
+    for (profile = 0; profile < RESAMPLE_NB; profile++)
+    {
+        SwrContext *swr = NULL;
+        int64_t total = (int64_t)in_rate * RESAMPLE_BENCH_SECONDS;
+        int64_t done;
+        clock_t start;
+        double cpu;
+
+        if (swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_FLT, out_rate, &layout, AV_SAMPLE_FMT_FLT, in_rate, 0, NULL) < 0 ||
+            resample_profile_apply(swr, profile) < 0 || swr_init(swr) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "  %-8s cannot be initialized\n", resample_profile_name(profile));
+            swr_free(&swr);
+            continue;
+        }
+
+        start = clock();
+        for (done = 0; done < total; done += RESAMPLE_BENCH_BLOCK)
+        {
+            const uint8_t *src = (const uint8_t *)in;
+            uint8_t *dst = (uint8_t *)out;
+
+            if (swr_convert(swr, &dst, out_max, &src, RESAMPLE_BENCH_BLOCK) < 0)
+                break;
+        }
+        cpu = (double)(clock() - start) / CLOCKS_PER_SEC;
+        swr_free(&swr);
+
+        av_log(NULL, AV_LOG_INFO, "  %-8s %8.3f ms CPU per channel second, %7.1fx real time  (%s)\n",
+            resample_profile_name(profile), cpu * 1000 / ((double)RESAMPLE_BENCH_SECONDS * channels),
+            cpu > 0 ? RESAMPLE_BENCH_SECONDS / cpu : 0,
+            *resample_profile_opts(profile) ? resample_profile_opts(profile) : "swr defaults");
+    }
+
+end:
+    av_channel_layout_uninit(&layout);
+    av_free(in);
+    av_free(out);
+}
@@ -0,0 +1,24 @@
+#ifndef FFCLIENT_RESAMPLE_H
+#define FFCLIENT_RESAMPLE_H
+
+#include <libswresample/swresample.h>
+
+/* speed against quality of the sample rate conversion, per session */
+enum ResampleProfile
+{
+    RESAMPLE_FAST,    /* short filter with linear interpolation, for slow ARM boxes */
+    RESAMPLE_DEFAULT, /* swresample defaults */
+    RESAMPLE_HQ,      /* soxr when swresample has it, a long swr filter otherwise */
+    RESAMPLE_NB
+};
+
+/* -1 for an unknown name */
+int resample_profile_parse(const char *name);
+const char *resample_profile_name(int profile);
+/* key=value pairs separated by ':', as aresample_swr_opts takes them */
+const char *resample_profile_opts(int profile);
+int resample_profile_apply(SwrContext *swr, int profile);
+/* converts generated audio with every profile and logs the CPU time per channel second */
+void resample_benchmark(int in_rate, int out_rate, int channels);
+
+#endif
@@ -0,0 +1,92 @@
+#include "skip.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/common.h>
+#include <libavutil/log.h>
+#include <libavutil/time.h>
+
+/* smoothing of the per frame load */
+#define SKIP_LOAD_ALPHA 0.1
+/* raise above this load, or above SKIP_LOAD_LATE while frames are dropped for being late */
+#define SKIP_LOAD_HIGH 0.9
+#define SKIP_LOAD_LATE 0.6
+/* relax below this load */
+#define SKIP_LOAD_LOW 0.5
+/* minimum time between two steps, relaxing waits longer so the level does not bounce */
+#define SKIP_RAISE_HOLD 500000
+#define SKIP_RELAX_HOLD 3000000
+
+void skip_controller_init(SkipController *s, int enabled)
+{
+    memset(s, 0, sizeof(*s));
+    s->enabled = enabled;
+    s->last_pts = NAN;
+    s->last_serial = -1;
+}
+
+/*
+ * called once per frame, busy_time is the decoding time the decoder has accumulated.
+ * The load is the decoding time between two frames over the time they are shown apart
+ * (timestamp difference over the speed), above 1 decoding cannot keep up.
+ * Returns 1 when the level changed and the decoder must be set up again.
+ */
+int skip_controller_update(SkipController *s, int64_t busy_time, double pts, double duration,
+                           double speed, int serial, int late)
+{
+    double interval = duration;
+    int64_t now;
+    int level;
+
+    if (!s->enabled)
+        return 0;
+
+    if (serial == s->last_serial && !isnan(pts) && !isnan(s->last_pts) && pts > s->last_pts)
+        interval = pts - s->last_pts;
+    /* at 2x the decoder has half the pts interval of wall clock time */
+    if (speed > 0)
+        interval /= speed;
+
+    if (serial == s->last_serial && interval > 0 && s->last_busy)
+    {
+        double load = (busy_time - s->last_busy) / 1000000.0 / interval;
+        s->load += SKIP_LOAD_ALPHA * (load - s->load);
+    }
+    s->last_busy = busy_time;
+    s->last_pts = pts;
+    s->last_serial = serial;
+
+    now = av_gettime_relative();
+    level = s->level;
+    if ((s->load > SKIP_LOAD_HIGH || (late && s->load > SKIP_LOAD_LATE)) &&
+        level < SKIP_LEVEL_NB - 1 && now - s->last_change > SKIP_RAISE_HOLD)
+        level++;
+    else if (s->load < SKIP_LOAD_LOW && !late &&
+             level > SKIP_LEVEL_NONE && now - s->last_change > SKIP_RELAX_HOLD)
+        level--;
+
+    if (level == s->level)
+        return 0;
+
+    av_log(NULL, AV_LOG_VERBOSE, "Decode load %.2f, skip level %d -> %d\n", s->load, s->level, level);
+    s->level = level;
+    s->last_change = now;
+    return 1;
+}
+
+void skip_controller_apply(const SkipController *s, int *skip_frame, int *skip_loop_filter)
+{
+    if (!s->enabled)
+        return;
+
+    if (s->level >= SKIP_LEVEL_LOOP_FILTER_NONREF)
+        *skip_loop_filter = FFMAX(*skip_loop_filter, AVDISCARD_NONREF);
+    if (s->level >= SKIP_LEVEL_LOOP_FILTER_ALL)
+        *skip_loop_filter = FFMAX(*skip_loop_filter, AVDISCARD_ALL);
+    if (s->level >= SKIP_LEVEL_NONREF)
+        *skip_frame = FFMAX(*skip_frame, AVDISCARD_NONREF);
+    if (s->level >= SKIP_LEVEL_NONKEY)
+        *skip_frame = FFMAX(*skip_frame, AVDISCARD_NONKEY);
+}
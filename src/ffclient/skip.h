@@ -0,0 +1,33 @@
+#ifndef FFCLIENT_SKIP_H
+#define FFCLIENT_SKIP_H
+
+#include <inttypes.h>
+
+enum SkipLevel
+{
+    SKIP_LEVEL_NONE,
+    SKIP_LEVEL_LOOP_FILTER_NONREF,
+    SKIP_LEVEL_LOOP_FILTER_ALL,
+    SKIP_LEVEL_NONREF,
+    SKIP_LEVEL_NONKEY,
+    SKIP_LEVEL_NB
+};
+
+/* raises the decoder discard level while decoding is slower than playback */
+typedef struct SkipController
+{
+    int enabled;
+    int level;
+    double load;          /* smoothed decode time / frame interval */
+    int64_t last_change;  /* av_gettime_relative() of the last level change */
+    int64_t last_busy;    /* decoder busy time at the previous frame */
+    double last_pts;
+    int last_serial;
+} SkipController;
+
+void skip_controller_init(SkipController *s, int enabled);
+int skip_controller_update(SkipController *s, int64_t busy_time, double pts, double duration,
+                           double speed, int serial, int late);
+void skip_controller_apply(const SkipController *s, int *skip_frame, int *skip_loop_filter);
+
+#endif
@@ -5,8 +5,6 @@
 #include <libavutil/macros.h>
 #include <libavutil/time.h>
 
-SDL_AudioDeviceID audio_dev;
-
 void stream_component_close(VideoState *is, int stream_index)
 {
     AVFormatContext *ic = is->ic;
@@ -19,22 +17,25 @@ void stream_component_close(VideoState *is, int stream_index)
     switch (codecpar->codec_type)
     {
     case AVMEDIA_TYPE_AUDIO:
+        /* the ring thread sees the aborted queue and stops converting */
+        is->audio_ring_abort = 1;
+        pcm_ring_wake(&is->audio_ring);
         decoder_abort(&is->auddec, &is->sampq);
-        SDL_CloseAudioDevice(audio_dev);
+        audio_mix_close(&is->audio_mix, ic);
+        SDL_WaitThread(is->audio_ring_tid, NULL);
+        is->audio_ring_tid = NULL;
+        if (is->audio_dev)
+            SDL_CloseAudioDevice(is->audio_dev);
+        is->audio_dev = 0;
+        null_sink_close(&is->audio_sink);
+        audio_shm_close(&is->audio_shm);
+        pcm_ring_free(&is->audio_ring);
+        meter_free(&is->meter);
         decoder_destroy(&is->auddec);
         swr_free(&is->swr_ctx);
         av_freep(&is->audio_buf1);
         is->audio_buf1_size = 0;
         is->audio_buf = NULL;
-
-        if (is->rdft)
-        {
-            av_tx_uninit(&is->rdft);
-            av_freep(&is->real_data);
-            av_freep(&is->rdft_data);
-            is->rdft = NULL;
-            is->rdft_bits = 0;
-        }
         break;
     case AVMEDIA_TYPE_VIDEO:
         decoder_abort(&is->viddec, &is->pictq);
@@ -64,7 +65,11 @@ void stream_close(VideoState *is)
 {
     /* XXX: use a special url_shutdown call to abort parse cleanly */
     is->abort_request = 1;
+    stream_wake_read_thread(is);
     SDL_WaitThread(is->read_tid, NULL);
+    jitter_destroy(&is->jitter_buf);
+    keyindex_stop(&is->keyindex);
+    playlist_free(&is->playlist);
 
     /* close each stream */
     if (is->audio_stream >= 0)
@@ -73,6 +78,7 @@ void stream_close(VideoState *is)
         stream_component_close(is, is->video_stream);
 
     avformat_close_input(&is->ic);
+    avformat_close_input(&is->prev_ic);
 
     packet_queue_destroy(&is->videoq);
     packet_queue_destroy(&is->audioq);
@@ -81,12 +87,44 @@ void stream_close(VideoState *is)
     frame_queue_destroy(&is->pictq);
     frame_queue_destroy(&is->sampq);
     SDL_DestroyCond(is->continue_read_thread);
+    SDL_DestroyMutex(is->continue_read_mutex);
+
+    /* the pool may still be scaling into the shared memory */
+    if (is->convert_mutex)
+    {
+        SDL_LockMutex(is->convert_mutex);
+        while (is->convert_busy)
+            SDL_CondWait(is->convert_cond, is->convert_mutex);
+        SDL_UnlockMutex(is->convert_mutex);
+    }
+    av_frame_free(&is->convert_frame);
+    SDL_DestroyCond(is->convert_cond);
+    SDL_DestroyMutex(is->convert_mutex);
+
+    sws_freeContext(is->sws_ctx);
+    sws_freeContext(is->tile_sws_ctx);
+    av_frame_free(&is->sws_dst);
+    dirty_free(&is->dirty);
+    av_frame_free(&is->step_frame);
+    gop_cache_free(&is->gop);
+    loop_cache_free(&is->loopc);
+    av_buffer_unref(&is->hw_device_ctx);
+    share_mem_close(&is->shm);
+
     av_free(is->filename);
+    av_free(is->mem_name);
+    av_free(is->hw_name);
+    av_free(is->audio_dump);
+    av_free(is->audio_shm_name);
+    av_free(is->index_dir);
     av_free(is);
 }
 
 int get_master_sync_type(VideoState *is)
 {
+    /* the audio clock follows time stretched audio, otherwise only the external clock can run at another speed */
+    if (is->speed != 1.0)
+        return is->audio_st && is->speed <= AUDIO_SPEED_MAX ? AV_SYNC_AUDIO_MASTER : AV_SYNC_EXTERNAL_CLOCK;
     if (is->av_sync_type == AV_SYNC_VIDEO_MASTER)
     {
         if (is->video_st)
@@ -138,10 +176,19 @@ void stream_seek(VideoState *is, int64_t pos, int64_t rel, int by_bytes)
         if (by_bytes)
             is->seek_flags |= AVSEEK_FLAG_BYTE;
         is->seek_req = 1;
-        SDL_CondSignal(is->continue_read_thread);
+        stream_wake_read_thread(is);
     }
 }
 
+void stream_wake_read_thread(VideoState *is)
+{
+    if (!is->continue_read_mutex)
+        return;
+    SDL_LockMutex(is->continue_read_mutex);
+    SDL_CondSignal(is->continue_read_thread);
+    SDL_UnlockMutex(is->continue_read_mutex);
+}
+
 /* pause or resume the video */
 void stream_toggle_pause(VideoState *is)
 {
@@ -156,10 +203,28 @@ void stream_toggle_pause(VideoState *is)
     }
     set_clock(&is->extclk, get_clock(&is->extclk), is->extclk.serial);
     is->paused = is->audclk.paused = is->vidclk.paused = is->extclk.paused = !is->paused;
+
+    /* a paused device stops calling back, nothing wakes up while paused */
+    if (is->audio_dev)
+        SDL_PauseAudioDevice(is->audio_dev, is->paused);
+    else if (is->audio_sink.tid)
+        null_sink_pause(&is->audio_sink, is->paused);
+    else if (is->audio_shm.tid)
+        audio_shm_pause(&is->audio_shm, is->paused);
+    /* the ring thread sleeps while paused */
+    if (!is->paused)
+        pcm_ring_wake(&is->audio_ring);
+    stream_wake_read_thread(is);
 }
 
 void toggle_pause(VideoState *is)
 {
+    /* continue from the picture stepped back to, not from the queue */
+    if (is->paused && is->step_frame && !is->realtime && is->ic)
+    {
+        is->seek_accurate_req = 1;
+        stream_seek(is, (int64_t)(is->step_pts * AV_TIME_BASE), 0, 0);
+    }
     stream_toggle_pause(is);
     is->step = 0;
 }
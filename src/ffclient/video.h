@@ -10,6 +10,7 @@
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
 
 #ifdef _WIN64
 #include <SDL.h>
@@ -20,6 +21,22 @@
 #include "clock.h"
 #include "frame.h"
 #include "decoder.h"
+#include "socket.h"
+#include "dirty.h"
+#include "skip.h"
+#include "jitter.h"
+#include "keyindex.h"
+#include "gopcache.h"
+#include "loopcache.h"
+#include "playlist.h"
+#include "pcmring.h"
+#include "gain.h"
+#include "nullsink.h"
+#include "audioshm.h"
+#include "meter.h"
+#include "resample.h"
+#include "latency.h"
+#include "audiomix.h"
 
 #define EXTERNAL_CLOCK_MIN_FRAMES 2
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
@@ -29,6 +46,9 @@
 #define EXTERNAL_CLOCK_SPEED_MAX 1.010
 #define EXTERNAL_CLOCK_SPEED_STEP 0.001
 
+/* audio is time stretched with atempo up to this playback rate and dropped above */
+#define AUDIO_SPEED_MAX 4.0
+
 /* no AV sync correction is done if below the minimum AV sync threshold */
 #define AV_SYNC_THRESHOLD_MIN 0.04
 /* AV sync correction is done if above the maximum AV sync threshold */
@@ -36,10 +56,6 @@
 /* If a frame duration is longer than this, it will not be duplicated to compensate AV sync */
 #define AV_SYNC_FRAMEDUP_THRESHOLD 0.1
 
-/* NOTE: the size must be big enough to compensate the hardware audio buffersize size */
-/* TODO: We assume that a decoded and resampled frame fits into this buffer */
-#define SAMPLE_ARRAY_SIZE (8 * 65536)
-
 enum
 {
     AV_SYNC_AUDIO_MASTER, /* default choice */
@@ -109,7 +125,23 @@ typedef struct VideoState
     unsigned int audio_buf_size; /* in bytes */
     unsigned int audio_buf1_size;
     int audio_buf_index; /* in bytes */
-    int audio_write_buf_size;
+    /* converted ahead by the ring thread, the callback only copies */
+    PcmRing audio_ring;
+    SDL_Thread *audio_ring_tid;
+    int audio_ring_abort;
+    int audio_ring_ms;
+    int audio_float; /* float output when the device takes it */
+    int resample_profile; /* enum ResampleProfile */
+    double audio_filter_tempo; /* atempo of the audio graph, stream seconds per played second */
+    AudioLatency audio_latency;
+    int audio_latency_offset; /* ms added to the measured latency */
+    AudioMix audio_mix; /* other audio streams mixed into this one */
+    int audio_null;  /* no device, the null sink drives the audio clock */
+    char *audio_dump;
+    NullSink audio_sink;
+    char *audio_shm_name; /* PCM goes to the host through shared memory instead of a device */
+    AudioShm audio_shm;
+    AudioGain audio_gain;
     int audio_volume;
     int muted;
     struct AudioParams audio_src;
@@ -119,14 +151,9 @@ typedef struct VideoState
     int frame_drops_early;
     int frame_drops_late;
     enum ShowMode show_mode;
-    int16_t sample_array[SAMPLE_ARRAY_SIZE];
-    int sample_array_index;
-    int last_i_start;
-    AVTXContext *rdft;
-    av_tx_fn rdft_fn;
-    int rdft_bits;
-    float *real_data;
-    AVComplexFloat *rdft_data;
+    AudioMeter meter; /* levels and spectrum sent to the host */
+    int meter_rate;
+    int meter_bands;
     int xpos;
     double last_vis_time;
 
@@ -150,6 +177,7 @@ typedef struct VideoState
     int last_video_stream, last_audio_stream;
 
     SDL_cond *continue_read_thread;
+    SDL_mutex *continue_read_mutex; /* held when waking the read thread, so it can sleep without a timeout */
 
     char* mem_name;
     char* hw_name;
@@ -158,9 +186,115 @@ typedef struct VideoState
 
     int disable_audio;
     int nobuffer;
-} VideoState;
 
-extern SDL_AudioDeviceID audio_dev;
+    int id; /* session id on the control socket */
+    int img_max_width;
+    int img_max_height;
+    int img_width;
+    int img_height;
+    uint8_t size_sent;
+    uint8_t send_image;
+    ShareMem shm;
+
+    struct SwsContext *sws_ctx;
+    AVFrame *sws_dst;
+    struct SwsContext *tile_sws_ctx; /* scales into the mosaic tile */
+
+    AVBufferRef *hw_device_ctx;
+    enum AVPixelFormat hw_pix_fmt;
+
+    SDL_AudioDeviceID audio_dev;
+    int64_t audio_callback_time;
+
+    int seek_by_bytes;
+    int infinite_buffer;
+    int loop;
+    int64_t last_status_time;
+
+    /* conversion and publishing run on the shared pool */
+    int priority; /* enum PoolPriority */
+    SDL_mutex *convert_mutex;
+    SDL_cond *convert_cond;
+    AVFrame *convert_frame; /* newest picture waiting for the pool */
+    int convert_pending;
+    int convert_busy;
+
+    /* skip pictures and rows that did not change */
+    int dirty_detect;
+    int dirty_header;
+    int dirty_reset;
+    uint32_t dirty_seq;
+    DirtyMap dirty;
+
+    /* the host does not show this session */
+    int hidden;
+    int hidden_keyonly;
+
+    /* output frame rate cap, 0 for none */
+    double max_fps;
+    double fps_next_pts;
+    int fps_serial;
+
+    SkipController skip;
+    int64_t skip_last_drops;
+
+    int reconnect;
+    /* input the main thread puts in place of ic, see stream_switch_input() */
+    AVFormatContext *switch_ic;
+    int switch_stream[AVMEDIA_TYPE_NB];
+    int switch_state; /* 1 posted, 2 switching on the main thread */
+    int switch_ret;
+
+    /* playback rate, scanning decodes keyframes only */
+    double speed;
+    int scan;
+    int scan_index; /* jump between keyframes with the demuxer index */
+
+    /* accurate seek: frames before seek_target are decoded but never queued */
+    int accurate_seek;
+    double seek_target;
+    int seek_video_serial;
+    int seek_audio_serial;
+    int seek_accurate_req; /* the next seek is accurate even without accurate_seek */
+
+    /* recently shown pictures, stepping back uses them instead of seeking */
+    int64_t step_cache_size;
+    GopCache gop;
+    AVFrame *step_frame; /* cached picture shown instead of the queue */
+    double step_pts;
+    int step_uploaded;
+    /* not cached: the GOP is decoded again up to gop_fill_target and kept */
+    double gop_fill_target;
+    int gop_fill_req;
+    int gop_fill_serial;
+    int step_back_ready;
+
+    /* short looping clips play from memory after the first pass */
+    int64_t loop_cache_size;
+    int64_t loop_cache_max;
+    LoopCache loopc;
+    int loop_replay;        /* 1 packets from memory, 2 pictures as well */
+    int loop_replay_serial; /* the video thread replays pictures for this serial */
+
+    /* playlist items follow each other on one timeline, the next one is opened ahead */
+    int playlist_file; /* the input is a list of urls */
+    Playlist playlist;
+    AVFormatContext *prev_ic; /* the item before, the decoder threads may still look at it */
+    int64_t item_offset;      /* AV_TIME_BASE, added to the timestamps of the current item */
+    int64_t item_end;         /* end of the packets queued so far, on the timeline */
+    int item_extradata;       /* streams whose next packet carries the new extradata, by media type */
+
+    /* keyframe table for inputs without a usable seek index, -1 decides from the input */
+    int keyindex_mode;
+    char *index_dir;
+    KeyIndex keyindex;
+
+    /* smooths live network input, -1 decides from the input */
+    int jitter;
+    int64_t jitter_min;
+    int64_t jitter_max;
+    JitterBuffer jitter_buf;
+} VideoState;
 
 void stream_component_close(VideoState *is, int stream_index);
 void stream_close(VideoState *is);
@@ -168,6 +302,7 @@ int get_master_sync_type(VideoState *is);
 double get_master_clock(VideoState *is);
 void stream_seek(VideoState *is, int64_t pos, int64_t rel, int by_bytes);
 void stream_toggle_pause(VideoState *is);
+void stream_wake_read_thread(VideoState *is);
 void toggle_pause(VideoState *is);
 void toggle_mute(VideoState *is);
 void update_volume(VideoState *is, int sign, double step);
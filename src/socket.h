@@ -3,20 +3,77 @@
 
 #include <inttypes.h>
 
-typedef union 
+/*
+ * Control socket protocol.
+ *
+ * The host may send the legacy 4 byte commands (start send, stop, volume),
+ * they always target session 0. Every other command is framed:
+ *
+ *   0xfc 0x5a <cmd> <reserved> <session u16 LE> <payload size u16 LE> <payload>
+ */
+#define SOCKET_CMD_HEAD_0 0xfc
+#define SOCKET_CMD_HEAD_1 0x5a
+#define SOCKET_CMD_HEAD_SIZE 8
+
+enum SocketCommand
+{
+    SOCKET_CMD_START_SEND = 0x01,
+    SOCKET_CMD_VOLUME = 0x02,
+    /* payload: u8 enum PoolPriority */
+    SOCKET_CMD_PRIORITY = 0x03,
+    /* payload: u8 visible, u8 flags (bit 0: keyframes only while hidden) */
+    SOCKET_CMD_VISIBILITY = 0x04,
+    /* payload: u16 LE frames per second, 0 removes the cap */
+    SOCKET_CMD_MAX_FPS = 0x05,
+    /* payload: u8 paused */
+    SOCKET_CMD_PAUSE = 0x06,
+    /* payload: u16 LE playback rate in percent, 400 and above scans keyframes only */
+    SOCKET_CMD_SPEED = 0x07,
+    /* payload: s8 direction, 1 steps forward and -1 back one frame, pauses the session */
+    SOCKET_CMD_STEP = 0x08,
+    /* payload: NUL separated urls appended to the playlist, played gapless after the current item */
+    SOCKET_CMD_PLAYLIST_ADD = 0x09,
+    /* payload: s16 LE ms the output adds after the device, e.g. a bluetooth sink */
+    SOCKET_CMD_AUDIO_LATENCY = 0x0a,
+    /* payload: u8 track (0 the main audio, 1.. the -audio_tracks streams), u16 LE gain in percent */
+    SOCKET_CMD_TRACK_GAIN = 0x0b,
+    /* payload: NUL separated "url w h mem_name [options...]" */
+    SOCKET_CMD_SESSION_OPEN = 0x10,
+    SOCKET_CMD_SESSION_CLOSE = 0x11,
+    /* payload: NUL separated layout, see mosaic_layout() */
+    SOCKET_CMD_MOSAIC_LAYOUT = 0x20,
+    SOCKET_CMD_MOSAIC_CLOSE = 0x21,
+};
+
+typedef union
 {
     int i32;
     uint8_t u8[4];
 } I32U8;
 
-extern uint8_t socket_send;
+/* one block of memory shared with the host */
+typedef struct ShareMem
+{
+    void *ptr;
+    int size;
+    int id;       /* shmid on linux */
+    void *handle; /* file mapping on windows */
+} ShareMem;
+
 extern uint8_t socket_conn;
 
 extern int need_exit;
 
 void init_socket(char* addr);
-void socket_send_image_size(char* name, int width, int height);
-void socket_send_image(void* ptr, int size);
+/* extra_size bytes are kept after the pixels, see DIRTY_HEADER_SIZE. < 0 when the block cannot be created */
+int socket_send_image_size(int session, ShareMem* mem, char* name, int width, int height, int extra_size);
+void socket_send_image(ShareMem* mem, void* ptr, int size);
+void socket_send_image_part(ShareMem* mem, int offset, void* ptr, int size);
+/* creates the PCM block and sends 0xff 0x55 with its size, < 0 when it cannot be created */
+int socket_send_audio_mem(int session, ShareMem* mem, char* name, int size);
+/* 0xff 0x56 <session u16 LE> <size u16 LE> <payload>, see METER_REPORT_SIZE() */
+void socket_send_audio_level(int session, const uint8_t* data, int size);
+void share_mem_close(ShareMem* mem);
 void socket_stop();
 
-#endif
\ No newline at end of file
+#endif
@@ -3,6 +3,7 @@
 #include <errno.h>
 
 #include <libavutil/log.h>
+#include <libavutil/mem.h>
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -18,40 +19,95 @@
 SOCKET socket_fd = INVALID_SOCKET;
 struct sockaddr_in socket_addr;
 uint8_t socket_conn = 0;
-uint8_t socket_send = 0;
-
-void *shm = NULL;
-HANDLE handel = NULL;
 
 uint8_t temp[256];
 
+/* replies come from the render, read and audio threads */
+static SDL_mutex *send_mutex;
+
+static int socket_send_all(const uint8_t *buf, int size)
+{
+    int pos = 0;
+
+    if (!send_mutex)
+        return -1;
+    SDL_LockMutex(send_mutex);
+    while (pos < size)
+    {
+        int len = send(socket_fd, (const char *)buf + pos, size - pos, 0);
+        if (len == SOCKET_ERROR || len == 0)
+            break;
+        pos += len;
+    }
+    SDL_UnlockMutex(send_mutex);
+    return pos < size ? -1 : 0;
+}
+
+static int socket_recv_all(uint8_t *buf, int size)
+{
+    int pos = 0;
+    while (pos < size)
+    {
+        int len = recv(socket_fd, buf + pos, size - pos, 0);
+        if (len == SOCKET_ERROR || len == 0)
+            return -1;
+        pos += len;
+    }
+    return 0;
+}
+
 static int socket_read(void *arg)
 {
     for (;;)
     {
-        int size = recv(socket_fd, temp, 256, 0);
-        if (size == 4)
+        if (socket_recv_all(temp, 4) < 0)
         {
-            if (temp[0] == 0xcf && temp[1] == 0x1f && temp[2] == 0xe4 && temp[3] == 0x98)
-            {
-                av_log(NULL, AV_LOG_INFO, "start send image\n");
-                socket_send = 1;
-            }
-            else if (temp[0] == 0xcf && temp[1] == 0x1f && temp[2] == 0x98 && temp[3] == 0x31)
+            need_exit = 1;
+            ffclient_wakeup();
+            break;
+        }
+        if (temp[0] == 0xcf && temp[1] == 0x1f && temp[2] == 0xe4 && temp[3] == 0x98)
+        {
+            av_log(NULL, AV_LOG_INFO, "start send image\n");
+            ffclient_command(0, SOCKET_CMD_START_SEND, NULL, 0);
+        }
+        else if (temp[0] == 0xcf && temp[1] == 0x1f && temp[2] == 0x98 && temp[3] == 0x31)
+        {
+            need_exit = 1;
+            ffclient_wakeup();
+            break;
+        }
+        else if (temp[0] == 0x35 && temp[1] == 0x67 && temp[2] == 0xA7)
+        {
+            av_log(NULL, AV_LOG_INFO, "set volume %d\n", temp[3]);
+            ffclient_command(0, SOCKET_CMD_VOLUME, &temp[3], 1);
+        }
+        else if (temp[0] == SOCKET_CMD_HEAD_0 && temp[1] == SOCKET_CMD_HEAD_1)
+        {
+            uint8_t *payload = NULL;
+            int session, size;
+
+            if (socket_recv_all(temp + 4, SOCKET_CMD_HEAD_SIZE - 4) < 0)
             {
                 need_exit = 1;
+                ffclient_wakeup();
                 break;
             }
-            else if (temp[0] == 0x35 && temp[1] == 0x67 && temp[2] == 0xA7)
+            session = temp[4] | temp[5] << 8;
+            size = temp[6] | temp[7] << 8;
+            if (size)
             {
-                av_log(NULL, AV_LOG_INFO, "set volume %d\n", temp[3]);
-                set_volume(temp[3]);
+                payload = av_malloc(size);
+                if (!payload || socket_recv_all(payload, size) < 0)
+                {
+                    av_free(payload);
+                    need_exit = 1;
+                    ffclient_wakeup();
+                    break;
+                }
             }
-        }
-        else if (size == SOCKET_ERROR || size == 0)
-        {
-            need_exit = 1;
-            break;
+            ffclient_command(session, temp[2], payload, size);
+            av_free(payload);
         }
     }
 
@@ -93,6 +149,7 @@ void init_socket(char *addr)
     socket_conn = 1;
     av_log(NULL, AV_LOG_INFO, "connect socket \"%d\" ok!\n", port);
 
+    send_mutex = SDL_CreateMutex();
     SDL_CreateThread(socket_read, "socket_read", NULL);
 }
 
@@ -104,41 +161,66 @@ void socket_stop()
         socket_fd = INVALID_SOCKET;
     }
     WSACleanup();
+}
+
+void socket_send_audio_level(int session, const uint8_t *data, int size)
+{
+    uint8_t temp[6 + 256];
 
-    if (shm != NULL)
+    if (!socket_conn || size > 256)
+        return;
+    temp[0] = 0xff;
+    temp[1] = 0x56;
+    temp[2] = session & 0xff;
+    temp[3] = (session >> 8) & 0xff;
+    temp[4] = size & 0xff;
+    temp[5] = (size >> 8) & 0xff;
+    memcpy(temp + 6, data, size);
+
+    if (socket_send_all(temp, 6 + size) < 0)
+    {
+        need_exit = 1;
+        ffclient_wakeup();
+    }
+}
+
+void share_mem_close(ShareMem *mem)
+{
+    if (mem->ptr != NULL)
     {
-        UnmapViewOfFile(shm);
-        shm = NULL;
+        UnmapViewOfFile(mem->ptr);
+        mem->ptr = NULL;
     }
-    if (handel != NULL)
+    if (mem->handle != NULL)
     {
-        CloseHandle(handel);
-        handel = NULL;
+        CloseHandle(mem->handle);
+        mem->handle = NULL;
     }
 }
 
-void socket_send_image_size(char *name, int width, int height)
+int socket_send_image_size(int session, ShareMem *mem, char *name, int width, int height, int extra_size)
 {
     // 创建共享内存
+    mem->size = width * height * 4 + extra_size;
+    mem->handle = CreateFileMapping(INVALID_HANDLE_VALUE,
+                                    NULL, PAGE_READWRITE, 0, mem->size, name);
 
-    handel = CreateFileMapping(INVALID_HANDLE_VALUE,
-                               NULL, PAGE_READWRITE, 0, width * height * 4, name);
-
-    if (handel == NULL)
+    if (mem->handle == NULL)
     {
-        fprintf(stderr, "share mem create failed\n");
-        exit(EXIT_FAILURE);
+        av_log(NULL, AV_LOG_ERROR, "share mem %s create failed: %lu\n", name, GetLastError());
+        return -1;
     }
 
     // 将共享内存连接到当前的进程地址空间
-    shm = MapViewOfFile(handel, FILE_MAP_ALL_ACCESS, 0, 0, 0);
-    if (shm == (void *)-1)
+    mem->ptr = MapViewOfFile(mem->handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (mem->ptr == NULL)
     {
-        fprintf(stderr, "share mem link failed\n");
-        exit(EXIT_FAILURE);
+        av_log(NULL, AV_LOG_ERROR, "share mem %s link failed: %lu\n", name, GetLastError());
+        share_mem_close(mem);
+        return -1;
     }
 
-    printf("Memory attched at %p\n", shm);
+    printf("Memory attched at %p\n", mem->ptr);
 
     uint8_t temp[32] = {0};
     I32U8 cov;
@@ -164,13 +246,66 @@ void socket_send_image_size(char *name, int width, int height)
     temp[12] = cov.u8[2];
     temp[13] = cov.u8[3];
 
-    if (send(socket_fd, temp, 16, 0) == SOCKET_ERROR)
+    temp[14] = session & 0xff;
+    temp[15] = (session >> 8) & 0xff;
+
+    if (socket_send_all(temp, 16) < 0)
     {
         need_exit = 1;
+        ffclient_wakeup();
     }
+    return 0;
 }
 
-void socket_send_image(void *ptr, int size)
+int socket_send_audio_mem(int session, ShareMem *mem, char *name, int size)
 {
-    memcpy(shm, ptr, size);
-}
\ No newline at end of file
+    uint8_t temp[16] = {0};
+    I32U8 cov;
+
+    mem->size = size;
+    mem->handle = CreateFileMapping(INVALID_HANDLE_VALUE,
+                                    NULL, PAGE_READWRITE, 0, mem->size, name);
+    if (mem->handle == NULL)
+    {
+        av_log(NULL, AV_LOG_ERROR, "share mem %s create failed: %lu\n", name, GetLastError());
+        return -1;
+    }
+    mem->ptr = MapViewOfFile(mem->handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (mem->ptr == NULL)
+    {
+        av_log(NULL, AV_LOG_ERROR, "share mem %s link failed: %lu\n", name, GetLastError());
+        share_mem_close(mem);
+        return -1;
+    }
+
+    temp[0] = 0xff;
+    temp[1] = 0x55;
+
+    cov.i32 = size;
+    temp[2] = cov.u8[0];
+    temp[3] = cov.u8[1];
+    temp[4] = cov.u8[2];
+    temp[5] = cov.u8[3];
+
+    temp[14] = session & 0xff;
+    temp[15] = (session >> 8) & 0xff;
+
+    if (socket_conn && socket_send_all(temp, 16) < 0)
+    {
+        need_exit = 1;
+        ffclient_wakeup();
+    }
+    return 0;
+}
+
+void socket_send_image(ShareMem *mem, void *ptr, int size)
+{
+    memcpy(mem->ptr, ptr, size);
+}
+
+void socket_send_image_part(ShareMem *mem, int offset, void *ptr, int size)
+{
+    if (offset < 0 || offset + size > mem->size)
+        return;
+    memcpy((uint8_t *)mem->ptr + offset, ptr, size);
+}